@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ACCOUNTING_H__
+#define __ACCOUNTING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//What a user is charged for when choosing a victim
+enum accounting_mode
+{
+	ACCOUNT_RSS, //sum of VmRSS over the user's processes, from /proc
+	ACCOUNT_CGROUP, //kernel counters in each job cgroup's memory.stat
+	ACCOUNT_PSS //Pss + SwapPss from smaps_rollup, shared pages split
+};
+
+//What processes are grouped by, both to compare memory use and to decide
+//what is killed: the heaviest unit under the key goes
+enum aggregation_key
+{
+	KEY_UID,
+	KEY_JOB, //cgroup at a given depth below the managed one (0: leaf)
+	KEY_SESSION,
+	KEY_PGRP
+};
+
+void set_accounting_mode(enum accounting_mode mode);
+enum accounting_mode get_accounting_mode();
+void set_aggregation_key(enum aggregation_key key, unsigned int job_depth);
+enum aggregation_key get_aggregation_key();
+//Victims are the highest scoring unit, where
+//  score = size + rate_weight * growth (kB/s) + swap_weight% * swap
+//with growth only known when the trend is sampled. Both default to 0.
+void set_score_weights(unsigned int rate_weight_s, unsigned int swap_weight_pct);
+char score_weighted();
+//Kill only as much of the victim as covers usage - limit + headroom,
+//largest processes (or job cgroups) first, falling back to the whole
+//victim if the OOM outlasts deadline_ms. headroom_mb 0 disables it.
+void set_minimal_kill(unsigned int headroom_mb, unsigned int deadline_ms);
+char minimal_kill_enabled();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
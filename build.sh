@@ -4,8 +4,27 @@
 #You'll likely need to customize this for your site
 #real build system to come later
 
-rm *.o a.out
+rm *.o a.out oomdump mkfixture oombench
 clang -g -I. -c oomkiller.c
 clang -g -I. -c log.c
+clang -g -I. -c event_loop.c
+clang -g -I. -c proc_status.c
+clang -g -I. -c proc_uring.c
+clang -g -I. -c cgroup_v1.c
+clang -g -I. -c cgroup_v2.c
+clang -g -I. -c psi.c
+clang -g -I. -c proc_table.c
+clang -g -I. -c latency.c
 clang++ -g -I. -std=c++11 -c find_victim.cpp
-clang++ -g *.o -l cgroup
+clang++ -g -I. -std=c++11 -c ledger.cpp
+clang++ -g -I. -std=c++11 -c proc_events.cpp
+clang++ -g -I. -std=c++11 -c scan_pool.cpp
+clang++ -g -I. -std=c++11 -c pss_cache.cpp
+clang++ -g -I. -std=c++11 -c trend.cpp
+clang++ -g -I. -std=c++11 -c control.cpp
+clang++ -g *.o -l cgroup -l pthread
+clang -g -I. -o oomdump oomdump.c
+#fixtures and benchmark, kept out of the daemon
+clang -g -I. -c fixture.c
+clang -g -I. -o mkfixture mkfixture.c fixture.o
+clang++ -g -I. -std=c++11 -o oombench oombench.cpp fixture.o find_victim.o ledger.o trend.o pss_cache.o scan_pool.o proc_status.o proc_uring.o event_loop.o log.o latency.o proc_table.o -l cgroup -l pthread
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CGROUP_BACKEND_H__
+#define __CGROUP_BACKEND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cgroup_context;
+
+//What differs between the v1 hierarchies and the unified (v2) hierarchy.
+//Paths passed to the *_cgroup operations are relative to the managed
+//cgroup.
+struct cgroup_backend
+{
+	const char* name;
+	//open control files and register cgc->oom_source with the event loop
+	int (*setup)(struct cgroup_context* cgc);
+	void (*teardown)(struct cgroup_context* cgc);
+	char (*is_oom)(struct cgroup_context* cgc);
+	//hold a set of processes still while they are signalled, then let
+	//them go so they can exit
+	void (*freeze_tasks)(struct cgroup_context* cgc, const pid_t* pids, size_t n);
+	void (*release_tasks)(struct cgroup_context* cgc, const pid_t* pids, size_t n);
+	//whole-cgroup operations; NULL if the backend has none
+	int (*freeze_cgroup)(struct cgroup_context* cgc, const char* path, char frozen);
+	int (*kill_cgroup)(struct cgroup_context* cgc, const char* path);
+	//register cgc->usage_source to fire as usage crosses each percentage
+	//of the limit; NULL if the backend has no usage thresholds
+	int (*watch_usage)(struct cgroup_context* cgc, const unsigned int* percent, int n);
+	//current usage and limit in bytes (limit UINT64_MAX or near if none)
+	int (*memory_usage)(struct cgroup_context* cgc, uint64_t* usage, uint64_t* limit);
+};
+
+extern const struct cgroup_backend cgroup_v1_backend;
+extern const struct cgroup_backend cgroup_v2_backend;
+
+const struct cgroup_backend* cgroup_backend_detect();
+void set_cgroup_root(const char* path);
+const char* get_cgroup_root();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,22 +32,59 @@
 #ifndef __CGROUP_CONTEXT_H__
 #define __CGROUP_CONTEXT_H__
 
+#include <stdint.h>
+#include <time.h>
+#include <event_loop.h>
+#include <cgroup_backend.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct cgroup_context
 {
-	int efd;
+	const struct cgroup_backend* backend;
+	int efd; //eventfd (v1) or inotify on memory.events (v2)
+	struct event_source oom_source; //wraps efd
+	struct event_source victim_timer; //re-check if victims don't exit
+	struct event_source psi_source; //memory pressure trigger, fd -1 if unused
+	struct event_source usage_source; //usage threshold eventfd, fd -1 if unused
+	char handling; //between an OOM event and the OOM clearing
+	int victims; //victims still registered with the event loop
+	int victims_armed; //victims, and usage in bytes, when the victim
+	uint64_t usage_armed; //timer was last armed
 	int ecfd;
 	int oomfd;
 	int oomctlfd;
+	int usagefd; //v1 memory.usage_in_bytes
+	int limitfd; //v1 memory.limit_in_bytes
+	uint64_t usage_warn; //lowest usage threshold, bytes
 	char* cgroup_path;
 	char* cgroup_name;
 	char* freezer_path;
 	struct cgroup* purgatory;
+	int purgatory_procs_fd;
+	int purgatory_state_fd;
+	int root_memory_procs_fd;
+	int root_freezer_procs_fd;
+	int events_fd; //v2 memory.events
+	int current_fd; //v2 memory.current
+	int max_fd; //v2 memory.max
+	uint64_t oom_count; //v2 memory.events oom counter at the last check
+	uint64_t oom_kill_count; //and its oom_kill counter
+	struct ledger* ledger; //NULL unless background sampling is enabled
+	char ledger_on_demand; //ledger started by a usage threshold
+	struct trend* trend; //recent growth per unit, NULL if not sampled
+	char partial_kill; //a minimal kill was made during this OOM
+	struct timespec partial_since;
+	uint64_t oom_start; //latency_now() at the wakeup which began this event
+	uint64_t signalled; //latency_now() when victims were last signalled, 0: none
 };
 
+void oom_check(struct cgroup_context* cgc, char force);
+void usage_warning(struct cgroup_context* cgc, char above);
+int intervene(struct cgroup_context* cgc);
+
 #ifdef __cplusplus
 }
 #endif
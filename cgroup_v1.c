@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//cgroup v1 backend: OOM notification through cgroup.event_control on
+//memory.oom_control (with the kernel OOM killer disabled), and a
+//libcgroup managed "purgatory" freezer group to hold victims still.
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include <libcgroup.h>
+
+#include <cgroup_context.h>
+#include <cgroup_backend.h>
+#include <event_loop.h>
+
+#include <log.h>
+
+//NOTE: will only work if memory.use_hierarchy=0 in root cgroup
+//(can be 1 in nested groups)
+static void stop_oomkiller(struct cgroup_context* cgc)
+{
+	write(cgc->oomctlfd, "1\n", 2);
+}
+static void start_oomkiller(struct cgroup_context* cgc)
+{
+	write(cgc->oomctlfd, "0\n", 2);
+}
+
+//Purgatory and the root cgroup.procs files serve every managed cgroup:
+//the first context set up creates and opens them, the last one torn
+//down closes them and deletes purgatory
+static struct
+{
+	int users;
+	char* memory_path;
+	char* freezer_path;
+	struct cgroup* purgatory;
+	int state_fd;
+	int procs_fd;
+	int root_freezer_procs_fd;
+	int root_memory_procs_fd;
+} shared;
+
+static void purgatory_get()
+{
+	if(shared.users++ > 0) return;
+	cgroup_init();
+	cgroup_get_subsys_mount_point("memory", &shared.memory_path);
+	if(get_cgroup_root())
+	{
+		free(shared.memory_path);
+		asprintf(&shared.memory_path, "%s", get_cgroup_root());
+	}
+	cgroup_get_subsys_mount_point("freezer", &shared.freezer_path);
+
+	shared.purgatory = cgroup_new_cgroup("purgatory");
+	cgroup_add_controller(shared.purgatory, "freezer");
+	cgroup_create_cgroup(shared.purgatory, 1);
+
+	//the kill path keeps these open so it never opens a file
+	char* path;
+	asprintf(&path, "/%s/purgatory/freezer.state", shared.freezer_path);
+	shared.state_fd = open(path, O_WRONLY|O_CLOEXEC);
+	free(path);
+	asprintf(&path, "/%s/purgatory/cgroup.procs", shared.freezer_path);
+	shared.procs_fd = open(path, O_WRONLY|O_CLOEXEC);
+	free(path);
+	asprintf(&path, "/%s/cgroup.procs", shared.freezer_path);
+	shared.root_freezer_procs_fd = open(path, O_WRONLY|O_CLOEXEC);
+	free(path);
+	asprintf(&path, "/%s/cgroup.procs", shared.memory_path);
+	shared.root_memory_procs_fd = open(path, O_WRONLY|O_CLOEXEC);
+	free(path);
+	if(shared.state_fd < 0 || shared.procs_fd < 0 ||
+		shared.root_freezer_procs_fd < 0 || shared.root_memory_procs_fd < 0)
+	{
+		slog(LOG_ALERT, "FATAL: Failed to open purgatory control files");
+		abort();
+	}
+	//purgatory is only frozen while a victim is being killed
+	write(shared.state_fd, "THAWED", 6);
+}
+
+static void purgatory_put()
+{
+	if(--shared.users > 0) return;
+	cgroup_delete_cgroup(shared.purgatory, 0);
+	cgroup_free(&shared.purgatory);
+	close(shared.state_fd);
+	close(shared.procs_fd);
+	close(shared.root_freezer_procs_fd);
+	close(shared.root_memory_procs_fd);
+	free(shared.memory_path);
+	free(shared.freezer_path);
+	shared.memory_path = shared.freezer_path = NULL;
+}
+
+static int v1_setup(struct cgroup_context* cgc)
+{
+	int cl;
+	char* event_command;
+	char* event_control_path;	
+	char* oom_control_path;
+	char* path;
+
+	cgc->efd = eventfd(0,0);
+	if(cgc->efd == -1)
+	{
+		slog(LOG_ALERT, "FATAL: failed to create eventfd");
+		abort();
+	}
+
+	purgatory_get();
+	cgc->cgroup_path = shared.memory_path;
+	cgc->freezer_path = shared.freezer_path;
+	cgc->purgatory = shared.purgatory;
+	cgc->purgatory_state_fd = shared.state_fd;
+	cgc->purgatory_procs_fd = shared.procs_fd;
+	cgc->root_freezer_procs_fd = shared.root_freezer_procs_fd;
+	cgc->root_memory_procs_fd = shared.root_memory_procs_fd;
+
+	asprintf(&event_control_path, "/%s/%s/cgroup.event_control",
+			cgc->cgroup_path, cgc->cgroup_name);
+	cgc->ecfd = open(event_control_path, O_WRONLY);
+	if(cgc->ecfd < 0)
+	{
+		slog(LOG_ALERT, 
+			"FATAL: failed to open cgroup event control: %s\n",
+			 event_control_path);
+		perror("cgroup.event_control");
+	}
+
+	asprintf(&oom_control_path, "/%s/%s/memory.oom_control",
+			cgc->cgroup_path, cgc->cgroup_name);
+	//oomfd is re-read with pread() by is_oom(); oomctlfd is for writing
+	cgc->oomfd = open(oom_control_path, O_RDONLY|O_CLOEXEC);
+	cgc->oomctlfd = open(oom_control_path, O_WRONLY|O_CLOEXEC);
+	if(!(cgc->oomfd >=0) || !(cgc->oomctlfd >= 0))
+	{
+		slog(LOG_ALERT,
+			"FATAL: Failed to open oom_control");
+		abort();
+	}
+
+	//usage and limit are read by the minimal-kill planner and usage thresholds
+	asprintf(&path, "/%s/%s/memory.usage_in_bytes", cgc->cgroup_path, cgc->cgroup_name);
+	cgc->usagefd = open(path, O_RDONLY|O_CLOEXEC);
+	free(path);
+	asprintf(&path, "/%s/%s/memory.limit_in_bytes", cgc->cgroup_path, cgc->cgroup_name);
+	cgc->limitfd = open(path, O_RDONLY|O_CLOEXEC);
+	free(path);
+
+	cl = asprintf(&event_command, "%d %d", cgc->efd, cgc->oomfd);
+	write(cgc->ecfd, event_command, cl);
+	free(event_control_path);
+	free(event_command);
+	free(oom_control_path);
+
+	cgc->oom_source.fd = cgc->efd;
+	if(event_loop_add(&cgc->oom_source, EPOLLIN) != 0)
+		return(-1);
+	stop_oomkiller(cgc);
+	return(0);
+}
+
+static void v1_teardown(struct cgroup_context* cgc)
+{
+	event_loop_del(&cgc->oom_source);
+	start_oomkiller(cgc);
+	close(cgc->oomfd);
+	close(cgc->oomctlfd);
+	close(cgc->ecfd);
+	close(cgc->efd);
+	if(cgc->usage_source.fd >= 0)
+	{
+		event_loop_del(&cgc->usage_source);
+		close(cgc->usage_source.fd);
+	}
+	if(cgc->usagefd >= 0) close(cgc->usagefd);
+	if(cgc->limitfd >= 0) close(cgc->limitfd);
+	cgc->cgroup_path = cgc->freezer_path = NULL;
+	cgc->purgatory = NULL;
+	purgatory_put();
+}
+
+//Returns 1 if the cgroup is under OOM, 0 if not and -1 if oom_control
+//could not be read. A single pread() into a fixed buffer.
+static char v1_is_oom(struct cgroup_context* cgc)
+{
+	char buf[256];
+	ssize_t len = pread(cgc->oomfd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0)
+	{
+		slog(LOG_ERR, "Error reading memory.oom_control: %s\n", strerror(errno));
+		return(-1);
+	}
+	buf[len] = '\0';
+	const char* p = strstr(buf, "under_oom");
+	if(p)
+	{
+		p += 9;
+		while(*p == ' ' || *p == '\t') p++;
+	}
+	if(!p || *p < '0' || *p > '9')
+	{
+		slog(LOG_ERR, "Unexpected memory.oom_control contents\n");
+		return(-1);
+	}
+	if(*p != '0') return(1);
+	return(0);	
+}
+
+//cgroup.procs takes exactly one pid per write(2), so batching means
+//reusing one open fd rather than combining writes
+static void write_pid(int fd, pid_t pid)
+{
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%d", pid);
+	write(fd, buf, len); //fails harmlessly if the process already exited
+}
+
+//Gather the victims in purgatory (which is left thawed between events)
+//and freeze the whole set with a single state change. Writing to
+//cgroup.procs moves every thread of the process, not just the one named.
+static void v1_freeze_tasks(struct cgroup_context* cgc, const pid_t* pids, size_t n)
+{
+	size_t i;
+	for(i = 0; i < n; i++)
+		write_pid(cgc->purgatory_procs_fd, pids[i]);
+	write(cgc->purgatory_state_fd, "FROZEN", 6);
+}
+
+//Out of the limited memory cgroup, then out of purgatory, which thaws
+//each one as it leaves
+static void v1_release_tasks(struct cgroup_context* cgc, const pid_t* pids, size_t n)
+{
+	size_t i;
+	for(i = 0; i < n; i++)
+	{
+		write_pid(cgc->root_memory_procs_fd, pids[i]);
+		write_pid(cgc->root_freezer_procs_fd, pids[i]);
+	}
+	write(cgc->purgatory_state_fd, "THAWED", 6); //anything we failed to move
+}
+
+static uint64_t read_bytes(int fd)
+{
+	char buf[32];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0) return(0);
+	buf[len] = '\0';
+	return(strtoull(buf, NULL, 10));
+}
+
+//Threshold eventfds fire on crossings in both directions, so look at
+//which side of the lowest threshold usage is on now
+static void usage_event(struct event_source* src, uint32_t events)
+{
+	struct cgroup_context* cgc = src->data;
+	uint64_t efdcounter;
+	read(src->fd, &efdcounter, sizeof(uint64_t));
+	usage_warning(cgc, read_bytes(cgc->usagefd) >= cgc->usage_warn);
+}
+
+static int v1_watch_usage(struct cgroup_context* cgc, const unsigned int* percent, int n)
+{
+	int i;
+	uint64_t limit = cgc->limitfd >= 0 ? read_bytes(cgc->limitfd) : 0;
+	if(limit == 0 || limit >= (1ULL << 62)) //unlimited reads as ~2^63
+	{
+		slog(LOG_ERR, "%s has no memory limit, not watching usage",
+			cgc->cgroup_name);
+		return(-1);
+	}
+
+	cgc->usage_source.fd = eventfd(0, EFD_CLOEXEC);
+	cgc->usage_source.handler = usage_event;
+	cgc->usage_source.data = cgc;
+	if(cgc->usagefd < 0 || cgc->usage_source.fd < 0)
+	{
+		slog(LOG_ERR, "Failed to set up usage thresholds: %s", strerror(errno));
+		if(cgc->usage_source.fd >= 0) close(cgc->usage_source.fd);
+		cgc->usage_source.fd = -1;
+		return(-1);
+	}
+	//one eventfd can carry any number of thresholds
+	cgc->usage_warn = limit;
+	for(i = 0; i < n; i++)
+	{
+		char* event_command;
+		uint64_t bytes = limit / 100 * percent[i];
+		int cl = asprintf(&event_command, "%d %d %llu", cgc->usage_source.fd,
+			cgc->usagefd, (unsigned long long)bytes);
+		if(write(cgc->ecfd, event_command, cl) < 0)
+			slog(LOG_ERR, "Failed to register %u%% usage threshold: %s",
+				percent[i], strerror(errno));
+		else if(bytes < cgc->usage_warn)
+			cgc->usage_warn = bytes;
+		free(event_command);
+	}
+	return(event_loop_add(&cgc->usage_source, EPOLLIN));
+}
+
+static int v1_memory_usage(struct cgroup_context* cgc, uint64_t* usage, uint64_t* limit)
+{
+	if(cgc->usagefd < 0 || cgc->limitfd < 0) return(-1);
+	*usage = read_bytes(cgc->usagefd);
+	*limit = read_bytes(cgc->limitfd);
+	return(0);
+}
+
+const struct cgroup_backend cgroup_v1_backend = {
+	"cgroup v1",
+	v1_setup,
+	v1_teardown,
+	v1_is_oom,
+	v1_freeze_tasks,
+	v1_release_tasks,
+	NULL,
+	NULL,
+	v1_watch_usage,
+	v1_memory_usage
+};
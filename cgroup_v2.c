@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//cgroup v2 (unified hierarchy) backend. There is no oom_control to
+//switch the kernel OOM killer off, so we act on memory.events changing:
+//inotify reports every update of the file, and is_oom() decides from the
+//counters and memory.current whether the group is actually at its limit.
+//Whole jobs are frozen and killed through cgroup.freeze and cgroup.kill.
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#include <cgroup_context.h>
+#include <cgroup_backend.h>
+#include <event_loop.h>
+
+#include <log.h>
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+#define CGROUP2_ROOT "/sys/fs/cgroup"
+
+static char* cgroup_root = NULL;
+
+//Looks for the memory hierarchy at path instead of its mount point (a
+//fixture tree, say): the cgroup2 root, or the v1 memory controller's
+void set_cgroup_root(const char* path)
+{
+	free(cgroup_root);
+	cgroup_root = strdup(path);
+}
+
+//NULL unless overridden
+const char* get_cgroup_root()
+{
+	return(cgroup_root);
+}
+
+//An overridden root counts as v2 if it has the v2 root's cgroup.controllers
+const struct cgroup_backend* cgroup_backend_detect()
+{
+	struct statfs fs;
+	char* path;
+	if(statfs(cgroup_root ? cgroup_root : CGROUP2_ROOT, &fs) == 0 &&
+		fs.f_type == CGROUP2_SUPER_MAGIC)
+		return(&cgroup_v2_backend);
+	if(!cgroup_root) return(&cgroup_v1_backend);
+	asprintf(&path, "%s/cgroup.controllers", cgroup_root);
+	int v2 = access(path, F_OK) == 0;
+	free(path);
+	return(v2 ? &cgroup_v2_backend : &cgroup_v1_backend);
+}
+
+static int open_control(struct cgroup_context* cgc, const char* file, int flags)
+{
+	char* path;
+	asprintf(&path, "%s/%s/%s", cgc->cgroup_path, cgc->cgroup_name, file);
+	int fd = open(path, flags|O_CLOEXEC);
+	if(fd < 0)
+		slog(LOG_ALERT, "Failed to open %s: %s", path, strerror(errno));
+	free(path);
+	return(fd);
+}
+
+static uint64_t read_u64(int fd)
+{
+	char buf[32];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0) return(0);
+	buf[len] = '\0';
+	if(strncmp(buf, "max", 3) == 0) return(UINT64_MAX);
+	return(strtoull(buf, NULL, 10));
+}
+
+//Returns 1 if memory.events counted a new OOM or OOM kill since the last
+//call, 0 if not and -1 if memory.events could not be read. Usage near
+//memory.max is no sign of OOM on its own (page cache fills a group to
+//its limit routinely), and the other counters (high, max) only mean
+//reclaim ran.
+static char v2_is_oom(struct cgroup_context* cgc)
+{
+	char buf[512];
+	ssize_t len = pread(cgc->events_fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0)
+	{
+		slog(LOG_ERR, "Error reading memory.events: %s\n", strerror(errno));
+		return(-1);
+	}
+	buf[len] = '\0';
+	const char* p = strstr(buf, "\noom ");
+	const char* k = strstr(buf, "\noom_kill ");
+	if(!p || !k)
+	{
+		slog(LOG_ERR, "Unexpected memory.events contents\n");
+		return(-1);
+	}
+	uint64_t oom = strtoull(p + 5, NULL, 10);
+	uint64_t oom_kill = strtoull(k + 10, NULL, 10);
+	char fresh = oom != cgc->oom_count || oom_kill != cgc->oom_kill_count;
+	cgc->oom_count = oom;
+	cgc->oom_kill_count = oom_kill;
+	return(fresh);
+}
+
+static int v2_setup(struct cgroup_context* cgc)
+{
+	char* path;
+	asprintf(&cgc->cgroup_path, "%s", cgroup_root ? cgroup_root : CGROUP2_ROOT);
+	cgc->freezer_path = NULL;
+	cgc->purgatory = NULL;
+	cgc->events_fd = open_control(cgc, "memory.events", O_RDONLY);
+	cgc->current_fd = open_control(cgc, "memory.current", O_RDONLY);
+	cgc->max_fd = open_control(cgc, "memory.max", O_RDONLY);
+	if(cgc->events_fd < 0 || cgc->current_fd < 0 || cgc->max_fd < 0)
+	{
+		slog(LOG_ALERT, "FATAL: memory controller not enabled for %s",
+			cgc->cgroup_name);
+		abort();
+	}
+	cgc->oom_count = 0;
+	cgc->oom_kill_count = 0;
+	v2_is_oom(cgc); //records the current oom count
+
+	cgc->efd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	asprintf(&path, "%s/%s/memory.events", cgc->cgroup_path, cgc->cgroup_name);
+	if(cgc->efd < 0 || inotify_add_watch(cgc->efd, path, IN_MODIFY) < 0)
+	{
+		slog(LOG_ALERT, "FATAL: failed to watch %s: %s", path, strerror(errno));
+		abort();
+	}
+	free(path);
+
+	cgc->oom_source.fd = cgc->efd;
+	return(event_loop_add(&cgc->oom_source, EPOLLIN));
+}
+
+static void v2_teardown(struct cgroup_context* cgc)
+{
+	event_loop_del(&cgc->oom_source);
+	close(cgc->efd);
+	close(cgc->events_fd);
+	close(cgc->current_fd);
+	close(cgc->max_fd);
+}
+
+//Per-process freezing needs a cgroup to move tasks into, and moving
+//tasks across v2 cgroups changes their memory accounting; the pidfd
+//signal is already atomic per process, so these are no-ops.
+static void v2_freeze_tasks(struct cgroup_context* cgc, const pid_t* pids, size_t n)
+{
+}
+
+static void v2_release_tasks(struct cgroup_context* cgc, const pid_t* pids, size_t n)
+{
+}
+
+static int write_control(struct cgroup_context* cgc, const char* path,
+	const char* file, const char* value)
+{
+	char* fullpath;
+	asprintf(&fullpath, "%s/%s%s/%s", cgc->cgroup_path, cgc->cgroup_name,
+		path, file);
+	int fd = open(fullpath, O_WRONLY|O_CLOEXEC);
+	free(fullpath);
+	if(fd < 0) return(-1);
+	int ret = write(fd, value, strlen(value)) < 0 ? -1 : 0;
+	close(fd);
+	return(ret);
+}
+
+static int v2_freeze_cgroup(struct cgroup_context* cgc, const char* path, char frozen)
+{
+	return(write_control(cgc, path, "cgroup.freeze", frozen ? "1" : "0"));
+}
+
+//cgroup.kill (5.14+) SIGKILLs every process in the subtree, including
+//ones forked after we scanned it. Fails on older kernels, and the caller
+//falls back to signalling the pids it knows about.
+static int v2_kill_cgroup(struct cgroup_context* cgc, const char* path)
+{
+	return(write_control(cgc, path, "cgroup.kill", "1"));
+}
+
+static int v2_memory_usage(struct cgroup_context* cgc, uint64_t* usage, uint64_t* limit)
+{
+	*usage = read_u64(cgc->current_fd);
+	*limit = read_u64(cgc->max_fd);
+	return(0);
+}
+
+const struct cgroup_backend cgroup_v2_backend = {
+	"cgroup v2",
+	v2_setup,
+	v2_teardown,
+	v2_is_oom,
+	v2_freeze_tasks,
+	v2_release_tasks,
+	v2_freeze_cgroup,
+	v2_kill_cgroup,
+	NULL,
+	v2_memory_usage
+};
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Metrics and control socket. Replies are built in full when the request
+//line arrives and written without blocking as the client drains them,
+//so a slow reader never holds up the event loop. Standings come from
+//scan_units(), which shares this epoch's scan with any OOM handling, and
+//are rescanned at most once per interval however often clients ask.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include <cgroup_context.h>
+#include <event_loop.h>
+
+#include <log.h>
+
+#include <snapshot.h>
+#include <accounting.h>
+#include <latency.h>
+#include <control.h>
+
+//a request line longer than this is refused
+#define MAX_REQUEST 256
+#define MAX_CLIENTS 16
+
+struct control_client
+{
+	struct event_source src;
+	std::string in;
+	std::string out;
+	size_t sent;
+	uid_t uid; //from SO_PEERCRED
+	pid_t pid;
+};
+
+struct standing
+{
+	std::string unit;
+	user_usage usage;
+	double score;
+	double rate; //kB/s
+	bool operator<(const standing& o) const { return(score > o.score); }
+};
+
+static struct event_source listener = { -1, NULL, NULL };
+static std::string socket_path;
+static struct cgroup_context* contexts;
+static int ncontexts;
+static std::set<control_client*> clients;
+static uint64_t scan_interval; //ns
+static uint64_t scanned_at;
+static std::vector<std::vector<standing> > cached; //per context
+
+static void append(std::string& out, const char* fmt, ...)
+{
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if(len < 0) return;
+	out.append(buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+//Good for both Prometheus label values and JSON strings
+static std::string escape(const std::string& s)
+{
+	std::string e;
+	for(std::string::const_iterator c = s.begin(); c != s.end(); c++)
+	{
+		if(*c == '"' || *c == '\\')
+		{
+			e += '\\';
+			e += *c;
+		}
+		else if(*c == '\n')
+			e += "\\n";
+		else if((unsigned char)*c >= 0x20)
+			e += *c;
+	}
+	return(e);
+}
+
+static const char* key_name()
+{
+	switch(get_aggregation_key())
+	{
+		case KEY_JOB: return("job");
+		case KEY_SESSION: return("session");
+		case KEY_PGRP: return("pgrp");
+		default: return("uid");
+	}
+}
+
+//Every unit of cgc, highest score (the victim) first. Returns false if
+//the cgroup couldn't be scanned.
+static bool standings(struct cgroup_context* cgc, std::vector<standing>& out)
+{
+	struct snapshot snap;
+	std::map<uint64_t, user_usage> units;
+	if(!scan_units(cgc, snap, units, false)) return(false);
+	for(std::map<uint64_t, user_usage>::iterator i = units.begin(); i != units.end(); i++)
+	{
+		standing s;
+		if(get_aggregation_key() == KEY_JOB)
+			s.unit = std::string(cgc->cgroup_name) + cgroup_relpath(snap, i->first);
+		else
+		{
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%llu", (unsigned long long)i->first);
+			s.unit = buf;
+		}
+		s.usage.rss = i->second.rss;
+		s.usage.swap = i->second.swap;
+		s.usage.uid = i->second.uid;
+		s.usage.pids.swap(i->second.pids);
+		s.score = unit_score(cgc, i->first, s.usage, s.rate);
+		out.push_back(s);
+	}
+	std::stable_sort(out.begin(), out.end());
+	return(true);
+}
+
+//Standings of every context, from the last scan if it is less than
+//scan_interval old
+static const std::vector<std::vector<standing> >& current_standings()
+{
+	uint64_t now = latency_now();
+	if((int)cached.size() == ncontexts && now - scanned_at < scan_interval)
+		return(cached);
+	cached.assign(ncontexts, std::vector<standing>());
+	for(int i = 0; i < ncontexts; i++)
+		standings(&contexts[i], cached[i]);
+	scanned_at = now;
+	return(cached);
+}
+
+//upper bound of histogram bucket b in seconds
+static double bucket_le(unsigned int b)
+{
+	return((2ULL << b) / 1e6);
+}
+
+static void prometheus(std::string& out)
+{
+	static const char* gauges[][2] = {
+		{ "oomkiller_unit_rss_kb", "Resident memory of each unit in kB" },
+		{ "oomkiller_unit_swap_kb", "Swapped out memory of each unit in kB" },
+		{ "oomkiller_unit_growth_kb_per_second", "Recent growth of each unit" },
+		{ "oomkiller_unit_tasks", "Processes in each unit" },
+		{ "oomkiller_unit_score", "Victim score of each unit" },
+	};
+	const std::vector<std::vector<standing> >& all = current_standings();
+	for(int g = 0; g < 5; g++)
+	{
+		append(out, "# HELP %s %s\n# TYPE %s gauge\n",
+			gauges[g][0], gauges[g][1], gauges[g][0]);
+		for(int i = 0; i < ncontexts; i++)
+		{
+			std::string cg = escape(contexts[i].cgroup_name);
+			for(std::vector<standing>::const_iterator s = all[i].begin(); s != all[i].end(); s++)
+			{
+				double v = g == 0 ? s->usage.rss : g == 1 ? s->usage.swap :
+					g == 2 ? s->rate : g == 3 ? s->usage.pids.size() : s->score;
+				append(out, "%s{cgroup=\"%s\",key=\"%s\",unit=\"%s\",uid=\"%u\"} %.0f\n",
+					gauges[g][0], cg.c_str(), key_name(), escape(s->unit).c_str(),
+					s->usage.uid, v);
+			}
+		}
+	}
+	append(out, "# HELP oomkiller_victim Unit that would be killed now (dry run), by score\n"
+		"# TYPE oomkiller_victim gauge\n");
+	for(int i = 0; i < ncontexts; i++)
+	{
+		if(all[i].empty()) continue;
+		append(out, "oomkiller_victim{cgroup=\"%s\",key=\"%s\",unit=\"%s\",uid=\"%u\"} %.0f\n",
+			escape(contexts[i].cgroup_name).c_str(), key_name(),
+			escape(all[i][0].unit).c_str(), all[i][0].usage.uid, all[i][0].score);
+	}
+	append(out, "# HELP oomkiller_handling 1 while an OOM is being handled\n"
+		"# TYPE oomkiller_handling gauge\n");
+	for(int i = 0; i < ncontexts; i++)
+		append(out, "oomkiller_handling{cgroup=\"%s\"} %d\n",
+			escape(contexts[i].cgroup_name).c_str(), contexts[i].handling ? 1 : 0);
+	for(int c = 0; c < NCOUNTERS; c++)
+	{
+		const char* name = latency_counter_name((enum latency_counter)c);
+		append(out, "# TYPE oomkiller_%s_total counter\noomkiller_%s_total %llu\n",
+			name, name, (unsigned long long)latency_counter((enum latency_counter)c));
+	}
+	append(out, "# TYPE oomkiller_loop_iterations_total counter\n"
+		"oomkiller_loop_iterations_total %llu\n", (unsigned long long)event_loop_epoch());
+	append(out, "# HELP oomkiller_latency_seconds Time spent in each phase of OOM handling\n"
+		"# TYPE oomkiller_latency_seconds histogram\n");
+	for(int p = 0; p < NPHASES; p++)
+	{
+		const char* phase = latency_phase_name((enum latency_phase)p);
+		const struct latency_histogram* h = latency_histogram((enum latency_phase)p);
+		uint64_t cumulative = 0;
+		for(unsigned int b = 0; b < LATENCY_BUCKETS - 1; b++)
+		{
+			cumulative += h->buckets[b];
+			append(out, "oomkiller_latency_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n",
+				phase, bucket_le(b), (unsigned long long)cumulative);
+		}
+		append(out, "oomkiller_latency_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n"
+			"oomkiller_latency_seconds_sum{phase=\"%s\"} %.9f\n"
+			"oomkiller_latency_seconds_count{phase=\"%s\"} %llu\n",
+			phase, (unsigned long long)h->count, phase, h->sum / 1e9,
+			phase, (unsigned long long)h->count);
+	}
+}
+
+static void json(std::string& out)
+{
+	out += "{\"key\":\"";
+	out += key_name();
+	out += "\",\"cgroups\":[";
+	const std::vector<std::vector<standing> >& by_context = current_standings();
+	for(int i = 0; i < ncontexts; i++)
+	{
+		const std::vector<standing>& all = by_context[i];
+		append(out, "%s{\"name\":\"%s\",\"handling\":%s,\"victims\":%d,\"victim\":",
+			i ? "," : "", escape(contexts[i].cgroup_name).c_str(),
+			contexts[i].handling ? "true" : "false", contexts[i].victims);
+		if(all.empty())
+			out += "null";
+		else
+			append(out, "\"%s\"", escape(all[0].unit).c_str());
+		out += ",\"units\":[";
+		for(std::vector<standing>::const_iterator s = all.begin(); s != all.end(); s++)
+			append(out, "%s{\"unit\":\"%s\",\"uid\":%u,\"rss_kb\":%llu,\"swap_kb\":%llu,"
+				"\"growth_kb_per_second\":%.0f,\"tasks\":%zu,\"score\":%.0f}",
+				s == all.begin() ? "" : ",", escape(s->unit).c_str(), s->usage.uid,
+				(unsigned long long)s->usage.rss, (unsigned long long)s->usage.swap,
+				s->rate, s->usage.pids.size(), s->score);
+		out += "]}";
+	}
+	out += "],\"counters\":{";
+	for(int c = 0; c < NCOUNTERS; c++)
+		append(out, "\"%s\":%llu,", latency_counter_name((enum latency_counter)c),
+			(unsigned long long)latency_counter((enum latency_counter)c));
+	append(out, "\"loop_iterations\":%llu},\"latency\":{",
+		(unsigned long long)event_loop_epoch());
+	for(int p = 0; p < NPHASES; p++)
+	{
+		const struct latency_histogram* h = latency_histogram((enum latency_phase)p);
+		append(out, "%s\"%s\":{\"count\":%llu,\"sum_seconds\":%.9f,\"max_seconds\":%.9f,"
+			"\"p50_seconds\":%.9f,\"p99_seconds\":%.9f,\"buckets\":[",
+			p ? "," : "", latency_phase_name((enum latency_phase)p),
+			(unsigned long long)h->count, h->sum / 1e9, h->max / 1e9,
+			latency_percentile((enum latency_phase)p, 50) / 1e9,
+			latency_percentile((enum latency_phase)p, 99) / 1e9);
+		for(unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+			append(out, "%s%llu", b ? "," : "", (unsigned long long)h->buckets[b]);
+		out += "]}";
+	}
+	out += "}}\n";
+}
+
+//Kills the named cgroup's victim now; the name may be left out when
+//only one cgroup is managed
+static void kill_now(const control_client* c, const std::string& name, std::string& out)
+{
+	struct cgroup_context* cgc = NULL;
+	for(int i = 0; i < ncontexts; i++)
+	{
+		if(name == contexts[i].cgroup_name || (name.empty() && ncontexts == 1))
+			cgc = &contexts[i];
+	}
+	if(!cgc)
+	{
+		out = "error: unknown cgroup\n";
+		return;
+	}
+	slog(LOG_ALERT, "Kill in %s requested by PID %d over the control socket",
+		cgc->cgroup_name, c->pid);
+	if(intervene(cgc) == 0)
+		out = "ok\n";
+	else
+		out = "error: already handling an OOM, or nothing to kill\n";
+}
+
+static void http_reply(std::string& out, const char* status, const char* type,
+	const std::string& body)
+{
+	append(out, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+		status, type, body.size());
+	out += body;
+}
+
+static void handle_request(control_client* c)
+{
+	std::string line = c->in.substr(0, c->in.find_first_of("\r\n"));
+	std::string cmd = line.substr(0, line.find(' '));
+	std::string arg = cmd.size() < line.size() ? line.substr(cmd.size() + 1) : "";
+	if(cmd == "GET")
+	{
+		std::string body;
+		std::string target = arg.substr(0, arg.find(' '));
+		if(target == "/metrics")
+		{
+			prometheus(body);
+			http_reply(c->out, "200 OK", "text/plain; version=0.0.4", body);
+		}
+		else if(target == "/json")
+		{
+			json(body);
+			http_reply(c->out, "200 OK", "application/json", body);
+		}
+		else
+			http_reply(c->out, "404 Not Found", "text/plain", "not found\n");
+	}
+	else if(cmd == "metrics")
+		prometheus(c->out);
+	else if(cmd == "json")
+		json(c->out);
+	else if((cmd == "kill" || cmd == "reload") && c->uid != 0)
+		c->out = "error: permission denied\n";
+	else if(cmd == "kill")
+		kill_now(c, arg, c->out);
+	else if(cmd == "reload")
+	{
+		c->out = "ok\n";
+		request_reload();
+	}
+	else
+		c->out = "error: unknown command\n";
+}
+
+static void client_close(control_client* c)
+{
+	event_loop_del(&c->src);
+	close(c->src.fd);
+	clients.erase(c);
+	delete c;
+}
+
+static void client_event(struct event_source* src, uint32_t events)
+{
+	control_client* c = (control_client*)src->data;
+	if(c->out.empty())
+	{
+		char buf[MAX_REQUEST];
+		ssize_t n = recv(src->fd, buf, sizeof(buf), 0);
+		if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+		if(n > 0)
+			c->in.append(buf, n);
+		if(n > 0 && c->in.find('\n') == std::string::npos && c->in.size() < MAX_REQUEST)
+			return; //wait for the rest of the line
+		if(c->in.empty() || c->in.size() >= MAX_REQUEST)
+		{
+			client_close(c);
+			return;
+		}
+		handle_request(c);
+		if(c->out.empty())
+		{
+			client_close(c);
+			return;
+		}
+		event_loop_del(src);
+		event_loop_add(src, EPOLLOUT);
+	}
+	while(c->sent < c->out.size())
+	{
+		ssize_t n = send(src->fd, c->out.data() + c->sent, c->out.size() - c->sent,
+			MSG_NOSIGNAL|MSG_DONTWAIT);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0 && errno == EAGAIN) return; //EPOLLOUT brings us back
+		if(n <= 0) break;
+		c->sent += n;
+	}
+	client_close(c);
+}
+
+static void accept_event(struct event_source* src, uint32_t events)
+{
+	int fd;
+	while((fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0)
+	{
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		if(clients.size() >= MAX_CLIENTS ||
+			getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		control_client* c = new control_client;
+		c->src.fd = fd;
+		c->src.handler = client_event;
+		c->src.data = c;
+		c->sent = 0;
+		c->uid = cred.uid;
+		c->pid = cred.pid;
+		if(event_loop_add(&c->src, EPOLLIN) != 0)
+		{
+			close(fd);
+			delete c;
+			continue;
+		}
+		clients.insert(c);
+	}
+}
+
+extern "C"
+{
+
+//Listens on path; root and the socket's group may connect, but only root
+//may kill or reload. Standings are rescanned at most every interval ms.
+//Returns 0 if listening (or already were).
+int control_start(const char* path, struct cgroup_context* ctxs, int n,
+	unsigned int interval)
+{
+	if(listener.fd >= 0) return(0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		slog(LOG_ERR, "Control socket path too long: %s", path);
+		return(-1);
+	}
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(fd < 0) return(-1);
+	unlink(path); //left behind by a crash or restart
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		chmod(path, 0660) != 0 || listen(fd, MAX_CLIENTS) != 0)
+	{
+		slog(LOG_ERR, "Error binding %s: %s", path, strerror(errno));
+		close(fd);
+		return(-1);
+	}
+	listener.fd = fd;
+	listener.handler = accept_event;
+	if(event_loop_add(&listener, EPOLLIN) != 0)
+	{
+		close(fd);
+		listener.fd = -1;
+		unlink(path);
+		return(-1);
+	}
+	socket_path = path;
+	contexts = ctxs;
+	ncontexts = n;
+	scan_interval = (uint64_t)interval * 1000000;
+	cached.clear();
+	return(0);
+}
+
+void control_stop()
+{
+	while(!clients.empty())
+		client_close(*clients.begin());
+	if(listener.fd < 0) return;
+	event_loop_del(&listener);
+	close(listener.fd);
+	listener.fd = -1;
+	unlink(socket_path.c_str());
+}
+
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cgroup_context;
+
+//Unix socket served from the event loop, mode 0660: create it in a setgid
+//directory to let that group scrape it. Each connection sends one line
+//and gets one reply:
+//  metrics          Prometheus text exposition
+//  json             the same as JSON
+//  kill [cgroup]    kill the current victim now (uid 0 only)
+//  reload           re-execute, re-reading the config (uid 0 only)
+//"GET /metrics" and "GET /json" HTTP requests are answered too, so
+//curl --unix-socket and HTTP scrapers work unchanged. Unit standings are
+//rescanned at most once per interval ms; requests in between get the last
+//scan's.
+int control_start(const char* path, struct cgroup_context* contexts, int n,
+	unsigned int interval);
+void control_stop();
+
+//implemented by the daemon
+void request_reload();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
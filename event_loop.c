@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Single epoll instance which multiplexes everything the daemon watches.
+//Each registered fd carries a pointer to its event_source, whose handler
+//is called from event_loop_run_once().
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#include <event_loop.h>
+#include <latency.h>
+#include <log.h>
+
+#define MAX_EVENTS 64
+
+static int epfd = -1;
+static uint64_t epoch = 0;
+static uint64_t woke = 0;
+
+int event_loop_init()
+{
+	if(epfd < 0)
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+	return(epfd < 0 ? -1 : 0);
+}
+
+int event_loop_add(struct event_source* src, uint32_t events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = src;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev) != 0)
+	{
+		slog(LOG_ERR, "event_loop_add(): %s\n", strerror(errno));
+		return(-1);
+	}
+	return(0);
+}
+
+void event_loop_del(struct event_source* src)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+//Waits up to timeout_ms (-1 forever) and dispatches whatever is ready.
+//Returns the number of events handled, or -1 on error.
+int event_loop_run_once(int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int i, n;
+	n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+	if(n < 0)
+	{
+		if(errno != EINTR)
+			slog(LOG_ERR, "epoll_wait(): %s\n", strerror(errno));
+		return(-1);
+	}
+	epoch++;
+	woke = latency_now();
+	for(i = 0; i < n; i++)
+	{
+		struct event_source* src = events[i].data.ptr;
+		src->handler(src, events[i].events);
+	}
+	return(n);
+}
+
+//Counts event_loop_run_once() wakeups: everything dispatched from one
+//epoll_wait() sees the same epoch
+uint64_t event_loop_epoch()
+{
+	return(epoch);
+}
+
+//latency_now() when epoll_wait() last returned
+uint64_t event_loop_woke()
+{
+	return(woke);
+}
+
+void event_loop_exit()
+{
+	if(epfd >= 0) close(epfd);
+	epfd = -1;
+}
+
+int timer_source_init(struct event_source* src, event_handler handler, void* data)
+{
+	src->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	src->handler = handler;
+	src->data = data;
+	if(src->fd < 0) return(-1);
+	return(event_loop_add(src, EPOLLIN));
+}
+
+//ms == 0 disarms the timer
+void timer_source_arm(struct event_source* src, unsigned int ms, char repeat)
+{
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	if(repeat) its.it_interval = its.it_value;
+	timerfd_settime(src->fd, 0, &its, NULL);
+}
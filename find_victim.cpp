@@ -35,7 +35,6 @@
 #include <map>
 #include <set>
 #include <iostream>
-#include <fstream>
 #include <cstring>
 #include <cstring>
 #include <stdint.h>
@@ -43,352 +42,1133 @@
 #include <sys/dir.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <dirent.h>
 #include <sstream>
 #include <signal.h>
 #include <syslog.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/resource.h>
 #include <errno.h>
 #include <exception>
+#include <algorithm>
 
 #include <libcgroup.h>
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
 #include <cgroup_context.h>
+#include <event_loop.h>
 
 #include <log.h>
 
-typedef uint64_t memory_t;
+#include <proc_status.h>
+#include <snapshot.h>
+#include <ledger.h>
+#include <scan_pool.h>
+#include <proc_uring.h>
+#include <accounting.h>
+#include <pss_cache.h>
+#include <trend.h>
+#include <latency.h>
+#include <proc_table.h>
+
+
+//Sends SIGKILL through the pidfd when we have one, so a recycled pid can
+//never be hit by mistake
+static void sigkill_victim(pid_t pid, int pidfd)
+{
+	if(pidfd >= 0)
+		syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+	else
+		kill(pid, SIGKILL);
+}
+
+//A signalled victim we wait on: by its pidfd while the fd budget lasts,
+//otherwise by polling its pid, with the start time telling a recycled
+//pid apart
+struct victim_source
+{
+	struct event_source src; //fd -1 when tracked by pid
+	struct cgroup_context* cgc;
+	pid_t pid;
+	unsigned long long starttime;
+};
+
+static std::map<pid_t, victim_source*> waiting;
+static std::set<victim_source*> polled;
+static struct event_source poll_timer = { -1, NULL, NULL };
+static size_t pidfds_held = 0;
+static size_t pidfd_budget = 0;
 
-void enumerate_tasks(char* cgpath, uid_t victim, std::vector<pid_t>& cached_task_list);
+//off only in oombench, whose fixture pids never exit
+static bool track_victims = true;
 
+//how often victims without a pidfd are checked for exit
+#define VICTIM_POLL_MS 100
+//never hold more pidfds than this, whatever the fd limit
+#define VICTIM_PIDFDS_MAX 65536
 
-uid_t get_uid(pid_t pid)
+//Pidfds we may hold: half the fd limit, leaving the rest to the scans
+//which have to keep working while victims exit
+static size_t pidfd_limit()
 {
-	char* status_path;
-	asprintf(&status_path, "/proc/%d/status", pid);
-	std::ifstream pid_status(status_path);
-	std::string line;
-	uid_t uid;
-	char found = 0;
-	while(pid_status.good())
+	if(!pidfd_budget)
 	{
-		std::getline(pid_status, line);
-		size_t pos = line.find("Uid:",0);
-		std::string token;
-		if(pos != std::string::npos)
-		{
-			std::stringstream ls(line,std::ios_base::in);
-			ls >> token; //header
-			ls >> uid;
-			found = 1;
-			break;
-		}
-	}	
-	if(!found) {
-		slog(LOG_ERR,"Error mapping UID for PID %d\n", pid);
+		struct rlimit nofile;
+		pidfd_budget = 512;
+		if(getrlimit(RLIMIT_NOFILE, &nofile) == 0)
+			pidfd_budget = nofile.rlim_cur == RLIM_INFINITY ?
+				VICTIM_PIDFDS_MAX : nofile.rlim_cur / 2;
+		if(pidfd_budget > VICTIM_PIDFDS_MAX)
+			pidfd_budget = VICTIM_PIDFDS_MAX;
 	}
-	pid_status.close();
-	free(status_path);
-	return(uid);
+	return(pidfd_budget);
 }
 
-memory_t get_rss(pid_t pid)
+//State and start time from /proc/<pid>/stat; -1 if the task is gone
+static int task_state(pid_t pid, char& state, unsigned long long& starttime)
 {
-	char* status_path;
-	asprintf(&status_path, "/proc/%d/status", pid);
-	std::ifstream pid_status(status_path);
-	std::string line;
-	uint64_t rss;
-	char found = 0;
+	char buf[1024];
+	if(read_proc_file(pid, "stat", buf, sizeof(buf)) < 0) return(-1);
+	const char* p = strrchr(buf, ')');
+	if(!p || p[1] != ' ') return(-1);
+	state = p[2];
+	for(int field = 2; field < 22; field++)
+	{
+		p = strchr(p + 1, ' ');
+		if(!p) return(-1);
+	}
+	starttime = strtoull(p + 1, NULL, 10);
+	return(0);
+}
 
-	while(pid_status.good())
+static void victim_gone(victim_source* v)
+{
+	struct cgroup_context* cgc = v->cgc;
+	waiting.erase(v->pid);
+	if(v->src.fd >= 0)
 	{
-		std::getline(pid_status, line);
-		size_t pos = line.find("VmRSS:",0);
-		std::string token;
-		if(pos != std::string::npos)
+		event_loop_del(&v->src);
+		close(v->src.fd);
+		pidfds_held--;
+	}
+	else
+	{
+		polled.erase(v);
+		if(polled.empty())
+			timer_source_arm(&poll_timer, 0, 0);
+	}
+	delete v;
+	if(--(cgc->victims) == 0)
+	{
+		if(cgc->signalled)
+			latency_record(PHASE_EXIT, cgc->signalled);
+		oom_check(cgc, 0);
+	}
+}
+
+//a victim's pidfd became readable: the process has exited
+static void victim_exited(struct event_source* src, uint32_t events)
+{
+	victim_gone((victim_source*)src->data);
+}
+
+//victims tracked by pid count as gone once they are zombies, or their
+//pid has been reused
+static void poll_victims(struct event_source* src, uint32_t events)
+{
+	uint64_t expirations;
+	read(src->fd, &expirations, sizeof(expirations));
+	std::vector<victim_source*> gone;
+	for(std::set<victim_source*>::iterator v = polled.begin(); v != polled.end(); v++)
+	{
+		char state;
+		unsigned long long starttime;
+		if(task_state((*v)->pid, state, starttime) != 0 || state == 'Z' ||
+			starttime != (*v)->starttime)
+			gone.push_back(*v);
+	}
+	for(size_t i = 0; i < gone.size(); i++)
+		victim_gone(gone[i]);
+}
+
+//Registers a signalled victim with the event loop; pidfd < 0 means it
+//has to be tracked by pid. Returns false if it is already gone.
+static bool wait_for_victim(struct cgroup_context* cgc, pid_t pid, int pidfd)
+{
+	victim_source* v = new victim_source;
+	v->cgc = cgc;
+	v->pid = pid;
+	v->starttime = 0;
+	v->src.fd = pidfd;
+	v->src.handler = victim_exited;
+	v->src.data = v;
+	if(pidfd >= 0)
+	{
+		if(event_loop_add(&v->src, EPOLLIN) != 0)
 		{
-			std::stringstream ls(line,std::ios_base::in);
-			ls >> token; //header
-			ls >> rss;
-			//FIXME assumes always kB, which is currently correct
-			//but could change
-			found = 1;
-			break;
+			close(pidfd);
+			delete v;
+			return(false);
 		}
+		pidfds_held++;
 	}
-	//if(!found) //ignore this case for now - due to races, it's fairly common 
-	//{
-	//	//note: this can happen for kthreads
-	//	slog(LOG_WARNING,"Error finding RSS for PID %d\n", pid);
-	//} 
-	pid_status.close();
-	free(status_path);
-	return(rss);
+	else
+	{
+		char state;
+		if(task_state(pid, state, v->starttime) != 0 || state == 'Z')
+		{
+			delete v;
+			return(false);
+		}
+		if(poll_timer.fd < 0 && timer_source_init(&poll_timer, poll_victims, NULL) != 0)
+		{
+			slog(LOG_ERR, "Failed to create victim poll timer\n");
+			delete v;
+			return(false);
+		}
+		if(polled.empty())
+			timer_source_arm(&poll_timer, VICTIM_POLL_MS, 1);
+		polled.insert(v);
+	}
+	waiting[pid] = v;
+	cgc->victims++;
+	return(true);
 }
 
-extern "C"
+#define PIDFD_GONE -2
+#define PIDFD_UNPINNED -3
+
+static double elapsed_ms(const struct timespec& start)
 {
-char is_oom(struct cgroup_context* cgc)
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return((end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+//Groups the victim's tasks into jobs: the highest cgroups below the
+//managed one whose subtrees hold no processes outside the victim. Tasks
+//sharing a cgroup with anyone else are left out and signalled one by one.
+static void victim_jobs(const struct snapshot& snap, const std::set<pid_t>& victims,
+	std::map<pid_t, uint64_t>& job_of)
 {
-	char* path;
-	asprintf(&path, "/%s/%s/memory.oom_control", cgc->cgroup_path, cgc->cgroup_name);
-	std::ifstream oc(path, std::ifstream::in);
-	char isoom = -1;
-	while(oc.good())
+	std::set<uint64_t> foreign;
+	for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
+	{
+		if(victims.count(t->pid)) continue;
+		std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(t->cgroup);
+		while(n != snap.cgroups.end() && foreign.insert(n->first).second)
+			n = snap.cgroups.find(n->second.parent);
+	}
+	for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
 	{
-		std::string token;
-		oc >> token;
-		if(token == "under_oom")
+		if(!victims.count(t->pid) || foreign.count(t->cgroup)) continue;
+		std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(t->cgroup);
+		if(n == snap.cgroups.end() || n->second.parent == 0) continue; //root
+		for(;;)
 		{
-			oc >> isoom;
+			std::map<uint64_t, cgroup_node>::const_iterator up =
+				snap.cgroups.find(n->second.parent);
+			if(up == snap.cgroups.end() || up->second.parent == 0 ||
+				foreign.count(up->first))
+				break;
+			n = up;
 		}
+		job_of[t->pid] = n->first;
 	}
-	oc.close();
-	free(path);
-	if(isoom == -1) abort();
-	if(isoom) return(1);
-	return(0);	
-}
 }
 
-void get_cgroup_from_pid(pid_t pid, std::string& result)
+//snap is the scan the victim was chosen from, or NULL (ledger picks);
+//with it, and a backend which can kill whole cgroups, the victim's jobs
+//are frozen and killed as units so nothing they fork mid-kill survives.
+void kill_victim(struct cgroup_context* cgc, uid_t victim_uid,
+	const std::vector<pid_t>& victim_pids, const struct snapshot* snap)
 {
-	char* path;
-	asprintf(&path, "/proc/%d/cgroup", pid);
-	std::ifstream gcl(path, std::ifstream::in);
-	try {
-		while(gcl.good())
+	//tasks signalled earlier and still exiting are not signalled again
+	std::vector<pid_t> cached_task_list;
+	for(size_t i = 0; i < victim_pids.size(); i++)
+	{
+		if(!waiting.count(victim_pids[i]))
+			cached_task_list.push_back(victim_pids[i]);
+	}
+	uint64_t start;
+	const struct cgroup_backend* backend = cgc->backend;
+	std::vector<int> pidfds(cached_task_list.size(), -1);
+	std::map<pid_t, uint64_t> job_of;
+	std::set<uint64_t> jobs;
+	std::vector<pid_t> loose; //victims not covered by a job cgroup
+
+	//Pin each victim with a pidfd before touching it, so nothing below
+	//can act on a recycled pid. Tasks which already exited are marked
+	//PIDFD_GONE; on kernels without pidfds (pre 5.3) we fall back to kill().
+	//Past the fd budget victims are PIDFD_UNPINNED: each gets a pidfd just
+	//long enough to be signalled, and is then tracked by pid.
+	size_t budget = pidfd_limit();
+	for(size_t i = 0; i < cached_task_list.size(); i++)
+	{
+		if(pidfds_held + i >= budget)
+		{
+			pidfds[i] = PIDFD_UNPINNED;
+			continue;
+		}
+		pidfds[i] = syscall(SYS_pidfd_open, cached_task_list[i], 0);
+		if(pidfds[i] < 0 && errno == ESRCH)
+			pidfds[i] = PIDFD_GONE;
+	}
+
+	if(snap && backend->kill_cgroup)
+	{
+		std::set<pid_t> victims(cached_task_list.begin(), cached_task_list.end());
+		victim_jobs(*snap, victims, job_of);
+	}
+	for(std::map<pid_t, uint64_t>::iterator i = job_of.begin(); i != job_of.end(); i++)
+		jobs.insert(i->second);
+	for(size_t i = 0; i < cached_task_list.size(); i++)
+	{
+		if(!job_of.count(cached_task_list[i]))
+			loose.push_back(cached_task_list[i]);
+	}
+
+	//Freeze all of user's processes
+	start = latency_now();
+	for(std::set<uint64_t>::iterator j = jobs.begin(); j != jobs.end(); j++)
+		backend->freeze_cgroup(cgc, cgroup_relpath(*snap, *j).c_str(), 1);
+	if(!loose.empty())
+		backend->freeze_tasks(cgc, &loose[0], loose.size());
+	slog(LOG_INFO, "Froze %zu processes in %.3f ms\n",
+		cached_task_list.size(), latency_record(PHASE_FREEZE, start) / 1e6);
+
+	//every signal goes out before anything is logged
+	std::vector<std::string> killed_jobs;
+	std::vector<size_t> signalled;
+	start = latency_now();
+	for(std::set<uint64_t>::iterator j = jobs.begin(); j != jobs.end(); j++)
+	{
+		std::string path = cgroup_relpath(*snap, *j);
+		if(backend->kill_cgroup(cgc, path.c_str()) == 0)
+		{
+			killed_jobs.push_back(path);
+			continue;
+		}
+		//no cgroup.kill: signal this job's tasks one by one
+		for(std::map<pid_t, uint64_t>::iterator i = job_of.begin(); i != job_of.end(); i++)
+		{
+			if(i->second == *j) i->second = 0;
+		}
+	}
+	for(size_t i = 0; i < cached_task_list.size(); i++)
+	{
+		std::map<pid_t, uint64_t>::iterator job = job_of.find(cached_task_list[i]);
+		if(pidfds[i] == PIDFD_GONE || (job != job_of.end() && job->second != 0))
+			continue;
+		if(pidfds[i] == PIDFD_UNPINNED)
 		{
-			std::string token;
-			gcl >> token;
-			size_t delim = 0;
-			delim = token.find_first_of(':');
-			token.erase(0, delim);
-			if(token.find("memory:/") != std::string::npos)
+			int fd = syscall(SYS_pidfd_open, cached_task_list[i], 0);
+			if(fd < 0 && errno == ESRCH) continue;
+			sigkill_victim(cached_task_list[i], fd);
+			if(fd >= 0) close(fd);
+		}
+		else
+			sigkill_victim(cached_task_list[i], pidfds[i]);
+		signalled.push_back(i);
+	}
+	uint64_t signal_ns = latency_record(PHASE_SIGNAL, start);
+	for(size_t i = 0; i < killed_jobs.size(); i++)
+		slog(LOG_ALERT, "killing UID:%u cgroup %s/%s%s\n", victim_uid,
+			cgc->cgroup_path, cgc->cgroup_name, killed_jobs[i].c_str());
+	if(!signalled.empty())
+	{
+		std::map<pid_t, const task_status*> status;
+		if(snap)
+		{
+			for(size_t i = 0; i < signalled.size(); i++)
+				status[cached_task_list[signalled[i]]] = NULL;
+			for(std::vector<task_status>::const_iterator t = snap->tasks.begin();
+				t != snap->tasks.end();
+				t++)
 			{
-				delim = token.find_first_of(':');
-				if((delim+1) > token.length())
-				{
-					result.append("/;");
-				}
-				else
-				{
-					result.append(token.substr(delim+1));
-					result.append(";");
-				}
+				std::map<pid_t, const task_status*>::iterator v = status.find(t->pid);
+				if(v != status.end()) v->second = &*t;
 			}
 		}
-	gcl.close();
+		for(size_t i = 0; i < signalled.size(); i++)
+		{
+			pid_t pid = cached_task_list[signalled[i]];
+			std::map<pid_t, const task_status*>::iterator v = status.find(pid);
+			if(v != status.end() && v->second)
+				slog_kill(victim_uid, pid, v->second->rss, v->second->cgroup);
+			else
+				slog_kill(victim_uid, pid, 0, 0);
+		}
 	}
-	catch (std::exception& e)
+	slog(LOG_INFO, "Signalled %zu processes in %.3f ms\n",
+		cached_task_list.size(), signal_ns / 1e6);
+	cgc->signalled = latency_now();
+	for(size_t i = 0; i < cached_task_list.size(); i++)
 	{
-		//This shouldn't really ever happen
-		//see gcc bug 53984
-		slog(LOG_ALERT, "Unexpected Exception reading cgroup file\n");
-		result.append(e.what());
+		if(pidfds[i] != PIDFD_GONE)
+			latency_count(COUNT_KILLED, 1);
+	}
+
+	//Release them so they can die
+	start = latency_now();
+	if(!loose.empty())
+		backend->release_tasks(cgc, &loose[0], loose.size());
+	for(std::set<uint64_t>::iterator j = jobs.begin(); j != jobs.end(); j++)
+		backend->freeze_cgroup(cgc, cgroup_relpath(*snap, *j).c_str(), 0);
+	slog(LOG_INFO, "Released %zu processes in %.3f ms\n",
+		cached_task_list.size(), (latency_now() - start) / 1e6);
+
+	//the main loop waits on these to learn when the victims are gone
+	for(size_t i = 0; i < pidfds.size(); i++)
+	{
+		if(!track_victims)
+		{
+			if(pidfds[i] >= 0) close(pidfds[i]);
+		}
+		else if(pidfds[i] >= 0)
+			wait_for_victim(cgc, cached_task_list[i], pidfds[i]);
+		else if(pidfds[i] == PIDFD_UNPINNED)
+			wait_for_victim(cgc, cached_task_list[i], -1);
 	}
-	free(path);
 }
 
-void sigkill_victim(pid_t pid)
+//Without tracking, kill_victim() forgets its victims once signalled:
+//nothing waits for them to exit and they may be picked again
+void set_victim_tracking(bool on)
 {
-	uid_t victim_uid;
-	std::string cgroups;
-	char* log_msg;
-	victim_uid = get_uid(pid);
-	get_cgroup_from_pid(pid, cgroups);
-	asprintf(&log_msg, "killing UID:%u PID %d; cgroups: %s\n", victim_uid, pid, 
-			 cgroups.c_str()
-			);
-	slog(LOG_ALERT, log_msg);
-	free(log_msg);
-	kill(pid, SIGKILL);
+	track_victims = on;
+}
 
+struct linux_dirent64
+{
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static enum accounting_mode accounting = ACCOUNT_RSS;
+
+static void account_task(const struct task_status& ts, struct snapshot& snap)
+{
+	snap.tasks.push_back(ts);
+	user_usage& u = snap.users[ts.uid];
+	u.rss += ts.rss;
+	u.pids.push_back(ts.pid);
 }
-void kill_victim(struct cgroup_context* cgc, uid_t victim_uid)
+
+static enum aggregation_key aggregation = KEY_UID;
+static unsigned int job_depth = 0;
+static unsigned int rate_weight = 0; //seconds of growth
+static unsigned int swap_weight = 0; //percent
+static unsigned int plan_headroom = 0; //MB, 0: kill the whole victim
+static unsigned int plan_deadline = 0; //ms
+
+extern "C"
+{
+void set_accounting_mode(enum accounting_mode mode)
 {
+	accounting = mode;
+}
 
-	std::vector<pid_t> cached_task_list;
-	//get PID list
-	char* cgpath;
-	asprintf(&cgpath, "/%s/%s/", cgc->cgroup_path, cgc->cgroup_name);	
-	enumerate_tasks(cgpath, victim_uid, cached_task_list);
-	free(cgpath);
+enum accounting_mode get_accounting_mode()
+{
+	return(accounting);
+}
 
-	struct rlimit core_limit;
-	core_limit.rlim_cur = 0;
-	core_limit.rlim_max = 0;
+void set_aggregation_key(enum aggregation_key key, unsigned int depth)
+{
+	aggregation = key;
+	job_depth = depth;
+}
 
-	//Freeze all of user's processes
-	for(std::vector<pid_t>::iterator i = cached_task_list.begin();
-		i!= cached_task_list.end();
-		i++)
+enum aggregation_key get_aggregation_key()
+{
+	return(aggregation);
+}
+
+void set_score_weights(unsigned int rate_weight_s, unsigned int swap_weight_pct)
+{
+	rate_weight = rate_weight_s;
+	swap_weight = swap_weight_pct;
+}
+
+char score_weighted()
+{
+	return(rate_weight > 0 || swap_weight > 0);
+}
+
+void set_minimal_kill(unsigned int headroom_mb, unsigned int deadline_ms)
+{
+	plan_headroom = headroom_mb;
+	plan_deadline = deadline_ms;
+}
+
+char minimal_kill_enabled()
+{
+	return(plan_headroom > 0);
+}
+}
+
+//cgroup accounting: the whole cgroup belongs to the uid of its first
+//process, so only that one status file is read. The others are listed
+//for the kill with no memory of their own.
+static void add_job_task(pid_t pid, uint64_t cgroup, struct snapshot& snap)
+{
+	cgroup_charge& c = snap.charges[cgroup];
+	struct task_status ts;
+	if(!c.owned)
 	{
-		cgroup_attach_task_pid(cgc->purgatory, *i);
+		if(read_task_status(pid, &ts) != 0) return;
+		c.owned = 1;
+		c.owner = ts.uid;
 	}
+	memset(&ts, 0, sizeof(ts));
+	ts.pid = pid;
+	ts.tgid = pid;
+	ts.uid = c.owner;
+	ts.found = TS_TGID|TS_UID;
+	ts.cgroup = cgroup;
+	account_task(ts, snap);
+}
 
-	char* root_freezer_path;
-	char* root_memory_path;
-	asprintf(&root_freezer_path, "/%s/tasks", cgc->freezer_path);
-	asprintf(&root_memory_path, "/%s/tasks", cgc->cgroup_path);
+static memory_t stat_value(const char* buf, const char* key)
+{
+	size_t len = strlen(key);
+	const char* p = buf;
+	while(p)
+	{
+		if(strncmp(p, key, len) == 0 && p[len] == ' ')
+			return(strtoull(p + len + 1, NULL, 10) / 1024);
+		p = strchr(p, '\n');
+		if(p) p++;
+	}
+	return(0);
+}
 
-	for(std::vector<pid_t>::iterator i = cached_task_list.begin();
-		i!= cached_task_list.end();
-		i++)
+//v1 memory.stat gives local counters (and total_* for the subtree); v2
+//only has hierarchical ones, which local_charges() turns into local.
+//v2 reports no swap usage in memory.stat, so it isn't charged there.
+static void read_memory_stat(int dirfd, uint64_t cgroup, struct snapshot& snap)
+{
+	char buf[8192];
+	int fd = openat(dirfd, "memory.stat", O_RDONLY|O_CLOEXEC);
+	if(fd < 0) return;
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(len <= 0) return;
+	buf[len] = '\0';
+	cgroup_charge& c = snap.charges[cgroup];
+	if(strstr(buf, "\ntotal_rss "))
 	{
-		FILE* root_freezer = fopen(root_freezer_path,"w");
-		FILE* root_memory = fopen(root_memory_path, "w");
-		sigkill_victim(*i);
-		fprintf(root_memory, "%d", *i);
-		fclose(root_memory);
-		fprintf(root_freezer, "%d", *i);
-		fclose(root_freezer);
-	}	
+		c.hierarchical = 0;
+		c.total = stat_value(buf, "rss") + stat_value(buf, "cache") +
+			stat_value(buf, "swap"); //mapped_file is part of cache
+	}
+	else
+	{
+		c.hierarchical = 1;
+		memory_t kernel = stat_value(buf, "kernel"); //5.18+
+		if(!kernel)
+			kernel = stat_value(buf, "slab") + stat_value(buf, "kernel_stack") +
+				stat_value(buf, "pagetables");
+		c.total = stat_value(buf, "anon") + stat_value(buf, "file") + kernel;
+	}
+}
 
-	free(root_memory_path);
-	free(root_freezer_path);
+//Under the session and pgrp keys, tasks whose status has no NSpgid or
+//NSsid take them from stat instead. False if the task has gone.
+static bool task_ids(struct task_status& ts)
+{
+	if(aggregation != KEY_SESSION && aggregation != KEY_PGRP) return(true);
+	if((ts.found & (TS_PGID|TS_SID)) == (TS_PGID|TS_SID)) return(true);
+	return(read_task_ids(ts.pid, &ts) == 0);
 }
 
-void enumerate_tasks(char* cgpath, uid_t victim_uid, std::vector<pid_t>& cached_task_list)
-{	
-	pid_t pid;
-	char* task_path;
-	asprintf(&task_path, "/%s/tasks", cgpath);
-	std::ifstream task_list(task_path,std::ifstream::in);
-	while(task_list.good())
+static void add_task(pid_t pid, uint64_t cgroup, struct snapshot& snap)
+{
+	if(!snap.seen.insert(pid).second) return;
+	if(accounting == ACCOUNT_CGROUP)
 	{
-		task_list >> pid;
-		if(!(task_list.good())) //last read seems to be garbage
-		{
-			break;
-		}
-		uid_t uid = get_uid(pid);
-		if(uid == victim_uid)
-		{
-			cached_task_list.push_back(pid);
-		}
+		add_job_task(pid, cgroup, snap);
+		return;
+	}
+	if(proc_uring_enabled())
+	{
+		snap.pending.push_back(pid); //read in one batch after the walk
+		snap.pending_cgroups.push_back(cgroup);
+		return;
+	}
+	struct task_status ts;
+	if(read_task_status(pid, &ts) != 0 || !task_ids(ts)) return;
+	if(accounting == ACCOUNT_PSS)
+		task_pss(&ts);
+	ts.cgroup = cgroup;
+	account_task(ts, snap);
+}
+
+static void resolve_pending(struct snapshot& snap)
+{
+	std::vector<struct task_status> st(snap.pending.size());
+	read_task_status_batch(&snap.pending[0], snap.pending.size(), &st[0]);
+	for(size_t i = 0; i < st.size(); i++)
+	{
+		st[i].cgroup = snap.pending_cgroups[i];
+		if(!(st[i].found & TS_UID) || !task_ids(st[i])) continue;
+		if(accounting == ACCOUNT_PSS)
+			task_pss(&st[i]);
+		account_task(st[i], snap);
 	}
-	task_list.close();
-	free(task_path);
+	snap.pending.clear();
+	snap.pending_cgroups.clear();
+}
 
-	DIR* cgd = opendir(cgpath);
-	if(cgd == NULL) slog(LOG_ALERT, "Error opening cgroup directory: %s\n", cgpath);
-	struct dirent* de;
-	struct stat stat_buf;
-	int r;
-	while((de=readdir(cgd))!=NULL)
+//path of a scanned cgroup relative to the root of the walk
+std::string cgroup_relpath(const struct snapshot& snap, uint64_t cgroup)
+{
+	std::string path;
+	std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(cgroup);
+	while(n != snap.cgroups.end() && n->second.parent != 0)
 	{
-		char* tmp_path;
-		asprintf(&tmp_path, "%s/%s/", cgpath, de->d_name);
-		r = stat(tmp_path, &stat_buf);
-		if(r!=0)
+		path.insert(0, "/" + n->second.name);
+		n = snap.cgroups.find(n->second.parent);
+	}
+	return(path);
+}
+
+//cgroup.procs rather than tasks: every thread reports the whole
+//process RSS, so counting threads would multiply it
+static void read_procs(int dirfd, uint64_t cgroup, struct snapshot& snap)
+{
+	char buf[16384];
+	ssize_t r;
+	pid_t pid = 0;
+	char in_pid = 0;
+	int fd = openat(dirfd, "cgroup.procs", O_RDONLY|O_CLOEXEC);
+	if(fd < 0) return; //cgroup removed under us
+	while((r = read(fd, buf, sizeof(buf))) > 0)
+	{
+		for(ssize_t i = 0; i < r; i++)
 		{
-			if(errno != ENOTDIR)
+			if(buf[i] >= '0' && buf[i] <= '9')
 			{
-		 	  slog(LOG_ALERT,
-			   "enumerate_tasks(): stat() error code: %s on \"%s\"",
-		  	   strerror(errno), tmp_path);
+				pid = pid * 10 + (buf[i] - '0');
+				in_pid = 1;
+			}
+			else if(in_pid)
+			{
+				add_task(pid, cgroup, snap);
+				pid = 0;
+				in_pid = 0;
 			}
 		}
-		else
+	}
+	if(in_pid) add_task(pid, cgroup, snap);
+	close(fd);
+}
+
+//Reads the process list of the cgroup at path (relative to rootfd) into
+//snap. Each child cgroup is handed to found() the moment it is listed,
+//so other scan threads can take it while this one carries on; without
+//found() children are scanned depth-first in place. Children are passed
+//by path and opened only when scanned, which keeps one directory fd open
+//per scanning thread however wide the hierarchy. Directory entries are
+//classified by d_type, so control files are never stat()ed.
+void scan_cgroup(int rootfd, const std::string& path, struct snapshot& snap,
+	cgroup_found found, void* arg)
+{
+	char buf[8192];
+	long n;
+	struct stat self;
+	int dirfd = openat(rootfd, path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(dirfd < 0)
+	{
+		if(errno != ENOENT) //ENOENT: removed since it was listed
+			slog(LOG_ALERT, "enumerate_users(): openat() error: %s on \"%s\"",
+				strerror(errno), path.c_str());
+		return;
+	}
+	fstat(dirfd, &self);
+	read_procs(dirfd, self.st_ino, snap);
+	if(accounting == ACCOUNT_CGROUP)
+		read_memory_stat(dirfd, self.st_ino, snap);
+	while((n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0)
+	{
+		for(long off = 0; off < n;)
 		{
-			if(S_ISDIR(stat_buf.st_mode) && de->d_name[0]!='.')
+			struct linux_dirent64* de = (struct linux_dirent64*)(buf + off);
+			off += de->d_reclen;
+			if(de->d_name[0] == '.') continue;
+			unsigned char type = de->d_type;
+			if(type == DT_UNKNOWN)
 			{
-				enumerate_tasks(tmp_path, victim_uid, cached_task_list);
+				struct stat stat_buf;
+				if(fstatat(dirfd, de->d_name, &stat_buf, AT_SYMLINK_NOFOLLOW) == 0 &&
+					S_ISDIR(stat_buf.st_mode))
+					type = DT_DIR;
 			}
+			if(type != DT_DIR) continue;
+			cgroup_node& node = snap.cgroups[de->d_ino];
+			node.parent = self.st_ino;
+			node.name = de->d_name;
+			std::string child = path + "/" + de->d_name;
+			if(found)
+				found(arg, child);
+			else
+				scan_cgroup(rootfd, child, snap, NULL, NULL);
 		}
-		free(tmp_path);
 	}
-	closedir(cgd);
+	if(n < 0)
+		slog(LOG_ALERT, "enumerate_users(): getdents64() error: %s", strerror(errno));
+	close(dirfd);
 }
 
-void enumerate_users(char* cgpath, std::map<uid_t, memory_t>& user_list)
+void enumerate_users(char* cgpath, struct snapshot& snap)
 {
-	char* task_path;
+	struct stat root;
+	int dirfd = open(cgpath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(dirfd < 0 || fstat(dirfd, &root) != 0)
+	{
+		slog(LOG_ALERT, "Error opening cgroup directory: %s\n", cgpath);
+		if(dirfd >= 0) close(dirfd);
+		return;
+	}
+	snap.cgroups[root.st_ino].parent = 0;
+	if(!scan_pool_enumerate(dirfd, snap))
+	{
+		scan_cgroup(dirfd, ".", snap, NULL, NULL);
+		close(dirfd);
+	}
+	if(!snap.pending.empty())
+		resolve_pending(snap);
+}
 
-	asprintf(&task_path, "/%s/tasks", cgpath);
-	std::ifstream task_list(task_path,std::ifstream::in);
-	pid_t pid;
-	while(task_list.good())
+//One scan shared by every supervised cgroup for the duration of an event
+//loop epoch. OOMs delivered together in nested groups walk the outer one
+//once; each context then works from the part under its own cgroup.
+static struct snapshot shared_snap;
+static uint64_t shared_epoch = 0;
+
+//memoizes the answer for every cgroup visited on the way up
+static bool in_subtree(const struct snapshot& snap, uint64_t cgroup, uint64_t root,
+	std::map<uint64_t, bool>& inside)
+{
+	std::vector<uint64_t> path;
+	bool result = false;
+	for(;;)
 	{
-		task_list >> pid;
-		if(!(task_list.good())) //last read seems to be garbage
+		if(cgroup == root)
 		{
+			result = true;
 			break;
 		}
-		uid_t uid = get_uid(pid);
-		memory_t rss = get_rss(pid);
-		if(user_list.find(uid)==user_list.end())
+		std::map<uint64_t, bool>::iterator m = inside.find(cgroup);
+		if(m != inside.end())
 		{
-			user_list[uid] = rss;
-		}
-		else
-		{
-			user_list[uid] = user_list[uid] + rss;
+			result = m->second;
+			break;
 		}
+		std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(cgroup);
+		if(n == snap.cgroups.end() || n->second.parent == 0) break;
+		path.push_back(cgroup);
+		cgroup = n->second.parent;
 	}
-	task_list.close();
-	free(task_path);
-
-	DIR* cgd = opendir(cgpath);
-	if(cgd == NULL) slog(LOG_ALERT, "Error opening cgroup directory: %s\n", cgpath);
-	struct dirent* de;
-	struct stat stat_buf;
-	int r;
-	while((de=readdir(cgd))!=NULL)
-	{
-		char* tmp_path;
-		asprintf(&tmp_path, "%s/%s/", cgpath, de->d_name);
-		r = stat(tmp_path, &stat_buf);
-		if(r!=0) {
-			if(errno != ENOTDIR)
-			{
-			  slog(LOG_ALERT, 
-			  "enumerate_users(): stat() error code: %s on \"%s\"",
-			  strerror(errno), tmp_path);
-			}
-		}
+	for(std::vector<uint64_t>::iterator i = path.begin(); i != path.end(); i++)
+		inside[*i] = result;
+	return(result);
+}
+
+//The cgroup a task or cgroup counts towards under KEY_JOB: the ancestor
+//job_depth levels below the root of the snapshot, or itself if it is
+//no deeper than that. job_depth 0 means the cgroup itself.
+static uint64_t job_cgroup(const struct snapshot& snap, uint64_t cgroup)
+{
+	if(job_depth == 0) return(cgroup);
+	std::vector<uint64_t> up; //cgroup, its parent, ... the root
+	std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(cgroup);
+	while(n != snap.cgroups.end())
+	{
+		up.push_back(n->first);
+		if(n->second.parent == 0) break;
+		n = snap.cgroups.find(n->second.parent);
+	}
+	if(up.size() <= job_depth + 1) return(cgroup);
+	return(up[up.size() - 1 - job_depth]);
+}
+
+static uint64_t task_key(const struct snapshot& snap, const struct task_status& ts)
+{
+	switch(aggregation)
+	{
+		case KEY_JOB:
+			return(job_cgroup(snap, ts.cgroup));
+		//a task whose ids could not be read is a unit of its own rather
+		//than lumped in with every other one under 0
+		case KEY_SESSION:
+			return((ts.found & TS_SID) ? ts.sid : ts.pid);
+		case KEY_PGRP:
+			return((ts.found & TS_PGID) ? ts.pgid : ts.pid);
+		default:
+			return(ts.uid);
+	}
+}
+
+//Each cgroup's own charge in kB. Hierarchical (v2) totals have the
+//children's totals taken off.
+static void local_charges(const struct snapshot& snap, std::map<uint64_t, int64_t>& local)
+{
+	for(std::map<uint64_t, cgroup_charge>::const_iterator c = snap.charges.begin();
+		c != snap.charges.end();
+		c++)
+	{
+		local[c->first] += c->second.total;
+		if(!c->second.hierarchical) continue;
+		std::map<uint64_t, cgroup_node>::const_iterator n = snap.cgroups.find(c->first);
+		if(n != snap.cgroups.end() && n->second.parent != 0)
+			local[n->second.parent] -= c->second.total;
+	}
+}
+
+//Sums tasks (and, in cgroup accounting, cgroup charges) into units of
+//the aggregation key. Charges of cgroups without processes count for a
+//job which has some; under KEY_UID they belong to nobody.
+static void aggregate(const struct snapshot& snap, std::map<uint64_t, user_usage>& units)
+{
+	for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
+	{
+		std::pair<std::map<uint64_t, user_usage>::iterator, bool> u =
+			units.insert(std::make_pair(task_key(snap, *t), user_usage()));
+		if(u.second)
+			u.first->second.uid = t->uid;
+		u.first->second.rss += (t->found & TS_PSS) ? t->pss : t->rss;
+		u.first->second.swap += t->swap;
+		u.first->second.pids.push_back(t->pid);
+	}
+	if(accounting != ACCOUNT_CGROUP) return;
+	std::map<uint64_t, int64_t> local;
+	local_charges(snap, local);
+	for(std::map<uint64_t, cgroup_charge>::const_iterator c = snap.charges.begin();
+		c != snap.charges.end();
+		c++)
+	{
+		if(local[c->first] <= 0) continue;
+		std::map<uint64_t, user_usage>::iterator u;
+		if(aggregation == KEY_JOB)
+			u = units.find(job_cgroup(snap, c->first));
+		else if(c->second.owned)
+			u = units.find(c->second.owner);
 		else
+			continue;
+		if(u != units.end())
+			u->second.rss += local[c->first];
+	}
+}
+
+//view gets the tasks and cgroups of snap which lie under root, with
+//root as the top of its tree
+static void snapshot_view(const struct snapshot& snap, uint64_t root,
+	struct snapshot& view)
+{
+	std::map<uint64_t, bool> inside;
+	for(std::map<uint64_t, cgroup_node>::const_iterator c = snap.cgroups.begin();
+		c != snap.cgroups.end();
+		c++)
+	{
+		if(in_subtree(snap, c->first, root, inside))
+			view.cgroups.insert(*c);
+	}
+	view.cgroups[root].parent = 0;
+	for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
+	{
+		if(in_subtree(snap, t->cgroup, root, inside))
+			account_task(*t, view);
+	}
+	if(accounting == ACCOUNT_CGROUP)
+	{
+		for(std::map<uint64_t, cgroup_charge>::const_iterator c = snap.charges.begin();
+			c != snap.charges.end();
+			c++)
 		{
-			if(S_ISDIR(stat_buf.st_mode) && de->d_name[0]!='.')
-			{
-				enumerate_users(tmp_path, user_list);
-			}
+			if(in_subtree(snap, c->first, root, inside))
+				view.charges.insert(*c);
 		}
-		free(tmp_path);
 	}
-	closedir(cgd);
 }
 
-extern "C"
+//drop killed tasks so later contexts in this epoch don't count them;
+//they stay in seen, so a rescan of an outer group won't read them again
+static void shared_forget(const std::vector<pid_t>& pids)
 {
-	int find_victim(struct cgroup_context* cgc)
+	std::set<pid_t> gone(pids.begin(), pids.end());
+	std::vector<task_status> kept;
+	for(std::vector<task_status>::iterator t = shared_snap.tasks.begin();
+		t != shared_snap.tasks.end();
+		t++)
+	{
+		if(!gone.count(t->pid)) kept.push_back(*t);
+	}
+	shared_snap.tasks.swap(kept);
+}
+
+//Each task's memory as selection counted it. Under cgroup accounting a
+//cgroup's own charge goes to the first of its tasks.
+static void task_sizes(const struct snapshot& snap, std::map<pid_t, memory_t>& size)
+{
+	std::map<uint64_t, int64_t> local;
+	std::set<uint64_t> charged;
+	if(accounting == ACCOUNT_CGROUP)
+		local_charges(snap, local);
+	for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
+	{
+		memory_t m = (t->found & TS_PSS) ? t->pss : t->rss;
+		if(accounting == ACCOUNT_CGROUP && charged.insert(t->cgroup).second &&
+			local[t->cgroup] > 0)
+			m += local[t->cgroup];
+		size[t->pid] = m;
+	}
+}
+
+struct plan_item
+{
+	memory_t size;
+	std::vector<pid_t> pids;
+	plan_item() : size(0) {}
+};
+
+static bool larger_item(const plan_item& a, const plan_item& b)
+{
+	return(a.size > b.size);
+}
+
+//Picks the fewest of the victim's processes, or its job cgroups where
+//the backend can kill whole cgroups, whose memory covers deficit kB,
+//largest first. Returns false if that would be all of them anyway.
+static bool plan_minimal_kill(struct cgroup_context* cgc, const struct snapshot& snap,
+	const std::vector<pid_t>& pids, memory_t deficit, std::vector<pid_t>& chosen)
+{
+	std::map<pid_t, memory_t> size;
+	std::map<pid_t, uint64_t> job_of;
+	std::map<std::pair<char, uint64_t>, plan_item> items; //(job?, cgroup or pid)
+	task_sizes(snap, size);
+	if(cgc->backend->kill_cgroup)
+	{
+		std::set<pid_t> victims(pids.begin(), pids.end());
+		victim_jobs(snap, victims, job_of);
+	}
+	for(std::vector<pid_t>::const_iterator p = pids.begin(); p != pids.end(); p++)
+	{
+		std::map<pid_t, uint64_t>::iterator j = job_of.find(*p);
+		plan_item& item = items[j != job_of.end() ?
+			std::make_pair((char)1, j->second) : std::make_pair((char)0, (uint64_t)*p)];
+		item.size += size[*p];
+		item.pids.push_back(*p);
+	}
+	std::vector<plan_item> sorted;
+	for(std::map<std::pair<char, uint64_t>, plan_item>::iterator i = items.begin();
+		i != items.end();
+		i++)
+		sorted.push_back(i->second);
+	std::sort(sorted.begin(), sorted.end(), larger_item);
+
+	memory_t covered = 0;
+	size_t n;
+	for(n = 0; n < sorted.size() && covered < deficit; n++)
+	{
+		chosen.insert(chosen.end(), sorted[n].pids.begin(), sorted[n].pids.end());
+		covered += sorted[n].size;
+	}
+	slog(LOG_INFO, "Minimal kill: %zu of %zu units, %llu kB for a %llu kB deficit\n",
+		n, sorted.size(), (unsigned long long)covered, (unsigned long long)deficit);
+	return(n < sorted.size());
+}
+
+//kB that must be freed: usage over the limit plus headroom, and at
+//least something when we act before the limit is reached (PSI)
+static memory_t kill_deficit(struct cgroup_context* cgc)
+{
+	uint64_t usage, limit;
+	int64_t deficit = (int64_t)plan_headroom << 10;
+	if(cgc->backend->memory_usage &&
+		cgc->backend->memory_usage(cgc, &usage, &limit) == 0 && limit < (1ULL << 62))
+		deficit += ((int64_t)usage - (int64_t)limit) / 1024;
+	return(deficit > 0 ? deficit : 1);
+}
+
+//Scans cgc's cgroup (or reuses this epoch's scan of an enclosing one)
+//into snap and sums it into units of the aggregation key. Returns false
+//if the cgroup can't be read.
+bool scan_units(struct cgroup_context* cgc, struct snapshot& snap,
+	std::map<uint64_t, user_usage>& units, bool verbose)
 {
-	std::map<uid_t,memory_t> user_list;
+	struct timespec start;
+	struct stat root;
 	char* cgpath;
 	asprintf(&cgpath, "/%s/%s/", cgc->cgroup_path, cgc->cgroup_name);
-	enumerate_users(cgpath, user_list);	
+	if(stat(cgpath, &root) != 0)
+	{
+		slog(LOG_ALERT, "Error opening cgroup directory: %s\n", cgpath);
+		free(cgpath);
+		return(false);
+	}
+	if(shared_epoch != event_loop_epoch())
+	{
+		shared_snap = snapshot();
+		shared_epoch = event_loop_epoch();
+	}
+	if(shared_snap.cgroups.count(root.st_ino))
+	{
+		if(verbose)
+			slog(LOG_INFO, "Reusing this round's scan for %s\n", cgc->cgroup_name);
+	}
+	else
+	{
+		size_t before = shared_snap.tasks.size();
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		enumerate_users(cgpath, shared_snap);
+		if(verbose)
+			slog(LOG_INFO, "Scanned %zu processes in %.3f ms with %u scan thread(s)\n",
+				shared_snap.tasks.size() - before, elapsed_ms(start), scan_pool_threads());
+	}
 	free(cgpath);
-	
-	if(user_list.size() < 1)
+	snapshot_view(shared_snap, root.st_ino, snap);
+	aggregate(snap, units);
+	return(true);
+}
+
+//Like scan_units(), but into a snapshot of its own, leaving the loop's
+//shared scan alone, so it may run off the event loop
+bool sample_units(char* cgpath, std::map<uint64_t, user_usage>& units)
+{
+	struct snapshot snap;
+	enumerate_users(cgpath, snap);
+	if(snap.cgroups.empty()) return(false);
+	aggregate(snap, units);
+	return(true);
+}
+
+//The unit's memory plus its weighted growth (returned in rate, kB/s)
+//and swap; the highest scoring unit is the victim
+double unit_score(struct cgroup_context* cgc, uint64_t key, const user_usage& usage,
+	double& rate)
+{
+	rate = rate_weight ? trend_rate(cgc->trend, key, usage.rss) : 0;
+	return(usage.rss + rate_weight * rate + swap_weight / 100.0 * usage.swap);
+}
+
+extern "C"
+{
+	int find_victim(struct cgroup_context* cgc)
+{
+	uid_t victim_uid;
+	std::vector<pid_t> victim_pids;
+	uint64_t start = latency_now();
+	if(ledger_pick_victim(cgc, victim_uid, victim_pids))
+	{
+		latency_record(PHASE_CHOOSE, start);
+		kill_victim(cgc, victim_uid, victim_pids, NULL);
+		proc_table_snapshot(cgc->cgroup_name, NULL, 0);
+		ledger_forget(cgc, victim_pids);
+		shared_forget(victim_pids);
+		return(0);
+	}
+
+	struct snapshot snap;
+	std::map<uint64_t, user_usage> units;
+	if(!scan_units(cgc, snap, units, true) || units.size() < 1)
 	{
 		return(-1);
 	}
+	latency_record(PHASE_SCAN, start);
+	latency_count(COUNT_SCANNED, snap.tasks.size());
+	start = latency_now();
 
-	memory_t max = (user_list.begin())->second;
-	uid_t max_uid = (user_list.begin())->first;
-	for(std::map<uid_t,memory_t>::iterator i = user_list.begin();
-		i!=user_list.end();
+	std::map<uint64_t, user_usage>::iterator victim = units.begin();
+	double victim_score = -1;
+	double victim_rate = 0;
+	for(std::map<uint64_t, user_usage>::iterator i = units.begin();
+		i != units.end();
 		i++)
 	{
-		if(i->second > max) 
+		double rate;
+		double score = unit_score(cgc, i->first, i->second, rate);
+		if(score > victim_score) 
 			{
-				max_uid = i->first;
-				max = i->second;
+				victim = i;
+				victim_score = score;
+				victim_rate = rate;
 			}
 	}
-	kill_victim(cgc, max_uid);
+	if(rate_weight || swap_weight)
+		slog(LOG_INFO, "Victim %llu scored %.0f: %llu kB, growing %.0f kB/s, %llu kB swap\n",
+			(unsigned long long)victim->first, victim_score,
+			(unsigned long long)victim->second.rss, victim_rate,
+			(unsigned long long)victim->second.swap);
+	if(aggregation == KEY_JOB)
+		slog(LOG_ALERT, "Victim job %s%s (UID %u): %llu kB in %zu processes\n",
+			cgc->cgroup_name, cgroup_relpath(snap, victim->first).c_str(),
+			victim->second.uid, (unsigned long long)victim->second.rss,
+			victim->second.pids.size());
+	else if(aggregation != KEY_UID)
+		slog(LOG_ALERT, "Victim %s %llu (UID %u): %llu kB in %zu processes\n",
+			aggregation == KEY_SESSION ? "session" : "process group",
+			(unsigned long long)victim->first, victim->second.uid,
+			(unsigned long long)victim->second.rss, victim->second.pids.size());
+	std::vector<pid_t> kill_pids;
+	if(plan_headroom && cgc->partial_kill && elapsed_ms(cgc->partial_since) > plan_deadline)
+	{
+		slog(LOG_ALERT, "Still out of memory %u ms after a minimal kill, killing all of the victim\n",
+			plan_deadline);
+		cgc->partial_kill = 0;
+	}
+	else if(plan_headroom &&
+		plan_minimal_kill(cgc, snap, victim->second.pids, kill_deficit(cgc), kill_pids))
+	{
+		if(!cgc->partial_kill)
+		{
+			cgc->partial_kill = 1;
+			clock_gettime(CLOCK_MONOTONIC, &cgc->partial_since);
+		}
+	}
+	if(kill_pids.empty())
+		kill_pids = victim->second.pids;
+	latency_record(PHASE_CHOOSE, start);
+	kill_victim(cgc, victim->second.uid, kill_pids, &snap);
+	if(proc_table_enabled())
+	{
+		std::set<pid_t> killed(kill_pids.begin(), kill_pids.end());
+		std::vector<task_status> victims;
+		for(std::vector<task_status>::const_iterator t = snap.tasks.begin();
+			t != snap.tasks.end();
+			t++)
+		{
+			if(killed.count(t->pid)) victims.push_back(*t);
+		}
+		proc_table_snapshot(cgc->cgroup_name, victims.empty() ? NULL : &victims[0],
+			victims.size());
+	}
+	ledger_forget(cgc, kill_pids);
+	shared_forget(kill_pids);
 	return(0);
 }
 		
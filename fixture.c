@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Builds the synthetic trees described in fixture.h. File contents follow
+//what a 6.x kernel prints, including the fields the daemon skips, so
+//parsing costs are realistic.
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ftw.h>
+
+#include <fixture.h>
+
+#define PAGE_KB 4
+
+static int write_file(const char* dir, const char* name, const char* text, size_t len)
+{
+	char* path;
+	asprintf(&path, "%s/%s", dir, name);
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	free(path);
+	if(fd < 0) return(-1);
+	ssize_t r = write(fd, text, len);
+	close(fd);
+	return(r == (ssize_t)len ? 0 : -1);
+}
+
+static int make_dir(const char* path)
+{
+	if(mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "mkdir %s: %s\n", path, strerror(errno));
+		return(-1);
+	}
+	return(0);
+}
+
+//xorshift; deterministic for a given seed
+static uint32_t next_random(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return(x);
+}
+
+//Mostly small tasks with a long tail: 1 MB to 4 GB, log-uniform
+static uint64_t random_rss_kb(uint32_t* state)
+{
+	unsigned int shift = 10 + next_random(state) % 13;
+	return((1ULL << shift) + next_random(state) % (1ULL << shift));
+}
+
+static int write_task(const char* procdir, pid_t pid, pid_t ppid, pid_t sid,
+	uid_t uid, const char* cgroup, uint64_t rss, uint64_t swap, uint64_t start)
+{
+	char dir[4096];
+	char buf[4096];
+	int len;
+	uint64_t anon = rss * 7 / 8;
+	uint64_t shmem = rss / 32;
+	uint64_t file = rss - anon - shmem;
+	snprintf(dir, sizeof(dir), "%s/%d", procdir, pid);
+	if(make_dir(dir) != 0) return(-1);
+	len = snprintf(buf, sizeof(buf),
+		"Name:\tworker\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\nNgid:\t0\n"
+		"Pid:\t%d\nPPid:\t%d\nTracerPid:\t0\nUid:\t%u\t%u\t%u\t%u\n"
+		"Gid:\t%u\t%u\t%u\t%u\nFDSize:\t64\nGroups:\t%u \nNStgid:\t%d\nNSpid:\t%d\n"
+		"NSpgid:\t%d\nNSsid:\t%d\nKthread:\t0\nVmPeak:\t%8llu kB\nVmSize:\t%8llu kB\n"
+		"VmLck:\t       0 kB\nVmPin:\t       0 kB\nVmHWM:\t%8llu kB\nVmRSS:\t%8llu kB\n"
+		"RssAnon:\t%8llu kB\nRssFile:\t%8llu kB\nRssShmem:\t%8llu kB\n"
+		"VmData:\t%8llu kB\nVmStk:\t     132 kB\nVmExe:\t     928 kB\n"
+		"VmLib:\t    2352 kB\nVmPTE:\t%8llu kB\nVmSwap:\t%8llu kB\n"
+		"HugetlbPages:\t       0 kB\nCoreDumping:\t0\nTHP_enabled:\t1\n"
+		"untag_mask:\t0xffffffffffffffff\nThreads:\t1\nSigQ:\t0/254886\n"
+		"SigPnd:\t0000000000000000\nShdPnd:\t0000000000000000\n"
+		"SigBlk:\t0000000000000000\nSigIgn:\t0000000000001000\n"
+		"SigCgt:\t0000000000000002\nCapInh:\t0000000000000000\n"
+		"CapPrm:\t0000000000000000\nCapEff:\t0000000000000000\n"
+		"CapBnd:\t000001ffffffffff\nCapAmb:\t0000000000000000\nNoNewPrivs:\t0\n"
+		"Seccomp:\t0\nSeccomp_filters:\t0\n"
+		"Speculation_Store_Bypass:\tthread vulnerable\n"
+		"SpeculationIndirectBranch:\tconditional enabled\n"
+		"Cpus_allowed:\tffffffff,ffffffff\nCpus_allowed_list:\t0-63\n"
+		"Mems_allowed:\t00000000,00000003\nMems_allowed_list:\t0-1\n"
+		"voluntary_ctxt_switches:\t1204\nnonvoluntary_ctxt_switches:\t37\n",
+		pid, pid, ppid, uid, uid, uid, uid, uid, uid, uid, uid, uid, pid, pid,
+		sid, sid, (unsigned long long)(rss * 2), (unsigned long long)(rss * 2),
+		(unsigned long long)rss, (unsigned long long)rss, (unsigned long long)anon,
+		(unsigned long long)file, (unsigned long long)shmem,
+		(unsigned long long)(anon + 1024), (unsigned long long)(rss / 512 + 60),
+		(unsigned long long)swap);
+	if(write_file(dir, "status", buf, len) != 0) return(-1);
+	len = snprintf(buf, sizeof(buf),
+		"%d (worker) S %d %d %d 0 -1 4194560 2210 0 3 0 518 97 0 0 20 0 1 0 "
+		"%llu %llu %llu 18446744073709551615 1 1 0 0 0 0 0 4096 2 0 0 0 17 3 0 0 "
+		"0 0 0 0 0 0 0 0 0 0\n", pid, ppid, sid, sid, (unsigned long long)start,
+		(unsigned long long)(rss * 2048), (unsigned long long)(rss / PAGE_KB));
+	if(write_file(dir, "stat", buf, len) != 0) return(-1);
+	len = snprintf(buf, sizeof(buf), "0::/%s\n", cgroup);
+	if(write_file(dir, "cgroup", buf, len) != 0) return(-1);
+	len = snprintf(buf, sizeof(buf),
+		"55d0c1a4f000-7ffd8e5f1000 ---p 00000000 00:00 0                          [rollup]\n"
+		"Rss:            %8llu kB\nPss:            %8llu kB\nPss_Dirty:      %8llu kB\n"
+		"Pss_Anon:       %8llu kB\nPss_File:       %8llu kB\nPss_Shmem:      %8llu kB\n"
+		"Shared_Clean:   %8llu kB\nShared_Dirty:          0 kB\nPrivate_Clean:  %8llu kB\n"
+		"Private_Dirty:  %8llu kB\nReferenced:     %8llu kB\nAnonymous:      %8llu kB\n"
+		"KSM:                   0 kB\nLazyFree:              0 kB\nAnonHugePages:         0 kB\n"
+		"ShmemPmdMapped:        0 kB\nFilePmdMapped:         0 kB\nShared_Hugetlb:        0 kB\n"
+		"Private_Hugetlb:       0 kB\nSwap:           %8llu kB\nSwapPss:        %8llu kB\n"
+		"Locked:                0 kB\n",
+		(unsigned long long)rss, (unsigned long long)(anon + file / 4),
+		(unsigned long long)anon, (unsigned long long)anon,
+		(unsigned long long)(file / 4), (unsigned long long)(shmem / 4),
+		(unsigned long long)(file - file / 4), (unsigned long long)(file / 4),
+		(unsigned long long)anon, (unsigned long long)rss, (unsigned long long)anon,
+		(unsigned long long)swap, (unsigned long long)swap);
+	return(write_file(dir, "smaps_rollup", buf, len));
+}
+
+//v2 control files; usage is hierarchical, as the kernel reports it
+static int write_controls(const char* dir, uint64_t anon_kb, uint64_t file_kb,
+	const char* procs, size_t procs_len)
+{
+	char buf[1024];
+	int len;
+	uint64_t kernel = (anon_kb + file_kb) / 64;
+	len = snprintf(buf, sizeof(buf),
+		"anon %llu\nfile %llu\nkernel %llu\nkernel_stack %llu\npagetables %llu\n"
+		"sec_pagetables 0\npercpu 0\nsock 0\nvmalloc 0\nshmem 0\nfile_mapped %llu\n"
+		"file_dirty 0\nfile_writeback 0\nswapcached 0\nanon_thp 0\nfile_thp 0\n"
+		"shmem_thp 0\ninactive_anon %llu\nactive_anon 0\ninactive_file %llu\n"
+		"active_file 0\nunevictable 0\nslab_reclaimable 0\nslab_unreclaimable 0\n"
+		"slab 0\npgfault 0\npgmajfault 0\n",
+		(unsigned long long)anon_kb * 1024, (unsigned long long)file_kb * 1024,
+		(unsigned long long)kernel * 1024, (unsigned long long)kernel * 256,
+		(unsigned long long)kernel * 768, (unsigned long long)file_kb * 1024,
+		(unsigned long long)anon_kb * 1024, (unsigned long long)file_kb * 1024);
+	if(write_file(dir, "memory.stat", buf, len) != 0) return(-1);
+	len = snprintf(buf, sizeof(buf), "%llu\n",
+		(unsigned long long)(anon_kb + file_kb + kernel) * 1024);
+	if(write_file(dir, "memory.current", buf, len) != 0) return(-1);
+	if(write_file(dir, "memory.max", "max\n", 4) != 0) return(-1);
+	const char* events = "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\noom_group_kill 0\n";
+	if(write_file(dir, "memory.events", events, strlen(events)) != 0) return(-1);
+	if(write_file(dir, "cgroup.freeze", "0\n", 2) != 0) return(-1);
+	return(write_file(dir, "cgroup.procs", procs, procs_len));
+}
+
+//Returns 0 on success; prints what went wrong otherwise
+int fixture_build(const char* dir, const struct fixture_spec* spec)
+{
+	unsigned int users = spec->users ? spec->users : 1;
+	unsigned int jobs = spec->jobs ? spec->jobs : 1;
+	unsigned int leaves = users * jobs;
+	uint64_t* anon = calloc(leaves, sizeof(uint64_t));
+	uint64_t* file = calloc(leaves, sizeof(uint64_t));
+	char** procs = calloc(leaves, sizeof(char*));
+	size_t* procs_len = calloc(leaves, sizeof(size_t));
+	char** paths = calloc(leaves, sizeof(char*)); //relative to the cgroup root
+	uint32_t state = spec->seed ? spec->seed : 1;
+	char* procdir;
+	char* cgdir;
+	char* path;
+	int ret = -1;
+	unsigned int u, j, d, t;
+	asprintf(&procdir, "%s/proc", dir);
+	asprintf(&cgdir, "%s/cgroup", dir);
+	if(!anon || !file || !procs || !procs_len || !paths ||
+		make_dir(dir) != 0 || make_dir(procdir) != 0 || make_dir(cgdir) != 0)
+		goto out;
+	//marks the root as v2 for cgroup_backend_detect()
+	if(write_file(cgdir, "cgroup.controllers", "cpu io memory pids\n", 19) != 0)
+		goto out;
+	asprintf(&path, "%s/%s", cgdir, spec->name);
+	if(make_dir(path) != 0)
+	{
+		free(path);
+		goto out;
+	}
+	free(path);
+
+	for(u = 0; u < users; u++)
+	{
+		for(j = 0; j < jobs; j++)
+		{
+			char* rel;
+			unsigned int l = u * jobs + j;
+			asprintf(&rel, "%s/user-%u", spec->name, FIXTURE_FIRST_UID + u);
+			for(d = 0; d <= spec->depth; d++)
+			{
+				asprintf(&path, "%s/%s", cgdir, rel);
+				if(make_dir(path) != 0)
+				{
+					free(path);
+					free(rel);
+					goto out;
+				}
+				free(path);
+				char* deeper;
+				if(d == 0)
+					asprintf(&deeper, "%s/job-%u", rel, j);
+				else
+					asprintf(&deeper, "%s/step-%u", rel, d);
+				free(rel);
+				rel = deeper;
+			}
+			asprintf(&path, "%s/%s", cgdir, rel);
+			if(make_dir(path) != 0)
+			{
+				free(path);
+				free(rel);
+				goto out;
+			}
+			free(path);
+			paths[l] = rel;
+		}
+	}
+
+	for(t = 0; t < spec->tasks; t++)
+	{
+		unsigned int l = t % leaves;
+		pid_t pid = FIXTURE_FIRST_PID + t;
+		pid_t leader = FIXTURE_FIRST_PID + l; //first task of the job
+		uint64_t rss = random_rss_kb(&state);
+		uint64_t swap = next_random(&state) % 8 == 0 ? rss / 4 : 0;
+		if(write_task(procdir, pid, pid == leader ? 1 : leader, leader,
+			FIXTURE_FIRST_UID + l / jobs, paths[l], rss, swap, 1000 + t) != 0)
+		{
+			fprintf(stderr, "Error writing task %d: %s\n", pid, strerror(errno));
+			goto out;
+		}
+		anon[l] += rss * 7 / 8;
+		file[l] += rss - rss * 7 / 8;
+		char line[16];
+		int len = snprintf(line, sizeof(line), "%d\n", pid);
+		procs[l] = realloc(procs[l], procs_len[l] + len);
+		memcpy(procs[l] + procs_len[l], line, len);
+		procs_len[l] += len;
+	}
+
+	//each job is a chain of cgroups with its tasks in the deepest one
+	uint64_t total_anon = 0, total_file = 0;
+	for(u = 0; u < users; u++)
+	{
+		uint64_t user_anon = 0, user_file = 0;
+		for(j = 0; j < jobs; j++)
+		{
+			unsigned int l = u * jobs + j;
+			char* rel = strdup(paths[l]);
+			for(d = 0; d <= spec->depth; d++)
+			{
+				asprintf(&path, "%s/%s", cgdir, rel);
+				int r = write_controls(path, anon[l], file[l], d ? "" : procs[l],
+					d ? 0 : procs_len[l]);
+				free(path);
+				if(r != 0)
+				{
+					free(rel);
+					goto out;
+				}
+				*strrchr(rel, '/') = '\0';
+			}
+			free(rel);
+			user_anon += anon[l];
+			user_file += file[l];
+		}
+		asprintf(&path, "%s/%s/user-%u", cgdir, spec->name, FIXTURE_FIRST_UID + u);
+		if(write_controls(path, user_anon, user_file, "", 0) != 0)
+		{
+			free(path);
+			goto out;
+		}
+		free(path);
+		total_anon += user_anon;
+		total_file += user_file;
+	}
+	asprintf(&path, "%s/%s", cgdir, spec->name);
+	if(write_controls(path, total_anon, total_file, "", 0) == 0)
+		ret = 0;
+	free(path);
+
+out:
+	if(ret != 0)
+		fprintf(stderr, "Failed to build fixture in %s\n", dir);
+	for(u = 0; paths && procs && u < leaves; u++)
+	{
+		free(paths[u]);
+		free(procs[u]);
+	}
+	free(paths);
+	free(procs);
+	free(procs_len);
+	free(anon);
+	free(file);
+	free(procdir);
+	free(cgdir);
+	return(ret);
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	return(remove(path));
+}
+
+int fixture_remove(const char* dir)
+{
+	return(nftw(dir, remove_entry, 64, FTW_DEPTH|FTW_PHYS));
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FIXTURE_H__
+#define __FIXTURE_H__
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//A synthetic procfs and cgroup hierarchy for running the scanner without
+//root or a real OOM. Under dir it creates
+//  proc/<pid>/{status,stat,cgroup,smaps_rollup}
+//  cgroup/<name>/user-<uid>/job-<n>/step-<d>/...   (depth levels deep)
+//with tasks spread round robin over the deepest cgroups, and the v2
+//control files the daemon and cgroup accounting read. Pids start at
+//FIXTURE_FIRST_PID, above the kernel's PID_MAX_LIMIT, so a kill aimed at
+//a fixture task can never reach a real process.
+#define FIXTURE_FIRST_PID 5000000
+#define FIXTURE_FIRST_UID 10000
+
+struct fixture_spec
+{
+	const char* name; //the managed cgroup
+	unsigned int users;
+	unsigned int jobs; //per user
+	unsigned int depth; //cgroup levels below each job
+	unsigned int tasks;
+	unsigned int seed;
+};
+
+int fixture_build(const char* dir, const struct fixture_spec* spec);
+int fixture_remove(const char* dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
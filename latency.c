@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Fixed-bucket latency histograms and counters for OOM handling. All of
+//it is static storage updated from the event loop thread, so recording
+//never allocates, locks or makes a syscall beyond clock_gettime().
+
+#include <stdint.h>
+#include <time.h>
+#include <syslog.h>
+
+#include <latency.h>
+#include <event_loop.h>
+#include <log.h>
+
+static struct latency_histogram histograms[NPHASES];
+static uint64_t counters[NCOUNTERS];
+
+static const char* phase_names[NPHASES] = {
+	"wake", "scan", "choose", "freeze", "signal", "exit", "recover", "total"
+};
+
+static const char* counter_names[NCOUNTERS] = {
+	"events", "tasks_scanned", "tasks_killed"
+};
+
+//CLOCK_MONOTONIC in ns
+uint64_t latency_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+//Adds the time since start (a latency_now() value) to phase's histogram
+//and returns it, in ns
+uint64_t latency_record(enum latency_phase phase, uint64_t start)
+{
+	uint64_t now = latency_now();
+	uint64_t ns = now > start ? now - start : 0;
+	struct latency_histogram* h = &histograms[phase];
+	uint64_t us = ns / 1000;
+	unsigned int b = 0;
+	while(us > 1 && b < LATENCY_BUCKETS - 1)
+	{
+		us >>= 1;
+		b++;
+	}
+	h->buckets[b]++;
+	h->count++;
+	h->sum += ns;
+	if(ns > h->max) h->max = ns;
+	return(ns);
+}
+
+void latency_count(enum latency_counter counter, uint64_t n)
+{
+	counters[counter] += n;
+}
+
+const struct latency_histogram* latency_histogram(enum latency_phase phase)
+{
+	return(&histograms[phase]);
+}
+
+uint64_t latency_counter(enum latency_counter counter)
+{
+	return(counters[counter]);
+}
+
+//Upper bound, in ns, of the bucket holding the pct'th percentile; 0 if
+//nothing was recorded. The top bucket reports the maximum seen.
+uint64_t latency_percentile(enum latency_phase phase, unsigned int pct)
+{
+	const struct latency_histogram* h = &histograms[phase];
+	if(h->count == 0) return(0);
+	uint64_t rank = (h->count * pct + 99) / 100;
+	uint64_t seen = 0;
+	unsigned int b;
+	for(b = 0; b < LATENCY_BUCKETS - 1; b++)
+	{
+		seen += h->buckets[b];
+		if(seen >= rank)
+		{
+			uint64_t bound = (2ULL << b) * 1000;
+			return(bound < h->max ? bound : h->max);
+		}
+	}
+	return(h->max);
+}
+
+const char* latency_phase_name(enum latency_phase phase)
+{
+	return(phase_names[phase]);
+}
+
+const char* latency_counter_name(enum latency_counter counter)
+{
+	return(counter_names[counter]);
+}
+
+//One line per phase and one for the counters
+void latency_log()
+{
+	int p;
+	for(p = 0; p < NPHASES; p++)
+	{
+		const struct latency_histogram* h = &histograms[p];
+		if(h->count == 0) continue;
+		slog(LOG_INFO, "latency %s: %llu samples, mean %.3f ms, p50 %.3f ms, "
+			"p99 %.3f ms, max %.3f ms", phase_names[p],
+			(unsigned long long)h->count, h->sum / 1e6 / h->count,
+			latency_percentile(p, 50) / 1e6, latency_percentile(p, 99) / 1e6,
+			h->max / 1e6);
+	}
+	slog(LOG_INFO, "%llu events, %llu tasks scanned, %llu tasks killed, "
+		"%llu loop iterations", (unsigned long long)counters[COUNT_EVENTS],
+		(unsigned long long)counters[COUNT_SCANNED],
+		(unsigned long long)counters[COUNT_KILLED],
+		(unsigned long long)event_loop_epoch());
+}
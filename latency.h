@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Phases of handling one OOM event, each with its own histogram
+enum latency_phase
+{
+	PHASE_WAKE, //epoll_wait() returning to the handler running
+	PHASE_SCAN, //scanning the cgroup hierarchy
+	PHASE_CHOOSE, //scoring units and planning the kill
+	PHASE_FREEZE,
+	PHASE_SIGNAL,
+	PHASE_EXIT, //signals sent to the last victim exiting
+	PHASE_RECOVER, //signals sent to is_oom() clearing
+	PHASE_TOTAL, //wakeup to is_oom() clearing
+	NPHASES
+};
+
+enum latency_counter
+{
+	COUNT_EVENTS, //OOM and pressure events handled
+	COUNT_SCANNED, //tasks scanned while choosing victims
+	COUNT_KILLED, //tasks signalled or in killed cgroups
+	NCOUNTERS
+};
+
+//bucket i counts durations in [2^i, 2^(i+1)) us; bucket 0 also takes
+//anything under 1 us and the last everything from 2^31 us up
+#define LATENCY_BUCKETS 32
+
+struct latency_histogram
+{
+	uint64_t count;
+	uint64_t sum; //ns
+	uint64_t max; //ns
+	uint64_t buckets[LATENCY_BUCKETS];
+};
+
+uint64_t latency_now();
+uint64_t latency_record(enum latency_phase phase, uint64_t start);
+void latency_count(enum latency_counter counter, uint64_t n);
+const struct latency_histogram* latency_histogram(enum latency_phase phase);
+uint64_t latency_counter(enum latency_counter counter);
+uint64_t latency_percentile(enum latency_phase phase, unsigned int pct);
+const char* latency_phase_name(enum latency_phase phase);
+const char* latency_counter_name(enum latency_counter counter);
+void latency_log();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
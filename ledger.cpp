@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Optional background sampler which keeps a per-pid and per-uid memory
+//ledger current, so that when an OOM event arrives the victim can be
+//picked in O(users) and confirmed with a handful of /proc reads instead
+//of a full scan of the hierarchy while the cgroup is stalled.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include <cgroup_context.h>
+
+#include <log.h>
+
+#include <proc_status.h>
+#include <snapshot.h>
+#include <ledger.h>
+#include <accounting.h>
+
+struct ledger_entry
+{
+	uid_t uid;
+	memory_t rss;
+	unsigned int generation;
+};
+
+struct ledger_user
+{
+	memory_t rss;
+	unsigned int nprocs;
+	ledger_user() : rss(0), nprocs(0) {}
+};
+
+struct ledger
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	char stop;
+	char kick; //sample again now rather than at the next interval
+	unsigned int interval_ms;
+	char* cgpath;
+	unsigned int generation;
+	struct timespec updated;
+	std::map<pid_t, ledger_entry> procs;
+	std::map<uid_t, ledger_user> users;
+};
+
+static uint64_t elapsed_ms(const struct timespec& since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((now.tv_sec - since.tv_sec) * 1000 +
+		(now.tv_nsec - since.tv_nsec) / 1000000);
+}
+
+static void ledger_remove(struct ledger* l, std::map<pid_t, ledger_entry>::iterator e)
+{
+	std::map<uid_t, ledger_user>::iterator u = l->users.find(e->second.uid);
+	u->second.rss -= e->second.rss;
+	if(--(u->second.nprocs) == 0)
+		l->users.erase(u);
+	l->procs.erase(e);
+}
+
+static void ledger_insert(struct ledger* l, pid_t pid, uid_t uid, memory_t rss,
+	unsigned int gen)
+{
+	ledger_entry ne;
+	ne.uid = uid;
+	ne.rss = rss;
+	ne.generation = gen;
+	l->procs[pid] = ne;
+	ledger_user& u = l->users[uid];
+	u.rss += rss;
+	u.nprocs++;
+}
+
+//fold a fresh scan into the ledger, touching only entries that changed
+static void ledger_merge(struct ledger* l, const struct snapshot& snap)
+{
+	pthread_mutex_lock(&l->lock);
+	unsigned int gen = ++(l->generation);
+	for(std::vector<struct task_status>::const_iterator t = snap.tasks.begin();
+		t != snap.tasks.end();
+		t++)
+	{
+		std::map<pid_t, ledger_entry>::iterator e = l->procs.find(t->pid);
+		if(e != l->procs.end() && e->second.uid != t->uid)
+		{
+			ledger_remove(l, e); //setuid; re-add below
+			e = l->procs.end();
+		}
+		if(e == l->procs.end())
+		{
+			ledger_insert(l, t->pid, t->uid, t->rss, gen);
+			continue;
+		}
+		e->second.generation = gen;
+		if(e->second.rss != t->rss)
+		{
+			ledger_user& u = l->users[t->uid];
+			u.rss = u.rss - e->second.rss + t->rss;
+			e->second.rss = t->rss;
+		}
+	}
+	for(std::map<pid_t, ledger_entry>::iterator e = l->procs.begin();
+		e != l->procs.end();)
+	{
+		std::map<pid_t, ledger_entry>::iterator next = e;
+		next++;
+		if(e->second.generation != gen)
+			ledger_remove(l, e);
+		e = next;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &l->updated);
+	pthread_mutex_unlock(&l->lock);
+}
+
+static void* ledger_sampler(void* arg)
+{
+	struct ledger* l = (struct ledger*)arg;
+	pthread_mutex_lock(&l->lock);
+	while(!l->stop)
+	{
+		pthread_mutex_unlock(&l->lock);
+		struct snapshot snap;
+		enumerate_users(l->cgpath, snap);
+		ledger_merge(l, snap);
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += l->interval_ms / 1000;
+		deadline.tv_nsec += (l->interval_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&l->lock);
+		while(!l->stop && !l->kick &&
+			pthread_cond_timedwait(&l->wake, &l->lock, &deadline) != ETIMEDOUT);
+		l->kick = 0;
+	}
+	pthread_mutex_unlock(&l->lock);
+	return(NULL);
+}
+
+extern "C"
+{
+int ledger_start(struct cgroup_context* cgc, unsigned int interval_ms)
+{
+	//the ledger sums per-process RSS by uid and confirms its picks
+	//from /proc; other accounting, keys, scoring and planning need scans
+	if(get_accounting_mode() != ACCOUNT_RSS || get_aggregation_key() != KEY_UID ||
+		score_weighted() || minimal_kill_enabled())
+	{
+		slog(LOG_INFO, "Ledger needs unweighted RSS by uid, using full scans\n");
+		return(-1);
+	}
+	struct ledger* l = new ledger;
+	pthread_condattr_t attr;
+	l->stop = 0;
+	l->kick = 0;
+	l->interval_ms = interval_ms;
+	l->generation = 0;
+	l->updated.tv_sec = 0;
+	l->updated.tv_nsec = 0;
+	asprintf(&l->cgpath, "/%s/%s/", cgc->cgroup_path, cgc->cgroup_name);
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&l->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	if(pthread_create(&l->thread, NULL, ledger_sampler, l) != 0)
+	{
+		slog(LOG_ALERT, "Failed to start ledger sampler, using full scans\n");
+		free(l->cgpath);
+		delete l;
+		return(-1);
+	}
+	cgc->ledger = l;
+	return(0);
+}
+
+void ledger_stop(struct cgroup_context* cgc)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	l->stop = 1;
+	pthread_cond_signal(&l->wake);
+	pthread_mutex_unlock(&l->lock);
+	pthread_join(l->thread, NULL);
+	pthread_cond_destroy(&l->wake);
+	pthread_mutex_destroy(&l->lock);
+	free(l->cgpath);
+	delete l;
+	cgc->ledger = NULL;
+}
+
+void ledger_kick(struct cgroup_context* cgc)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	l->kick = 1;
+	pthread_cond_signal(&l->wake);
+	pthread_mutex_unlock(&l->lock);
+}
+}
+
+//Pick the heaviest uid from the ledger and confirm it by re-reading the
+//status of just that uid's processes. Returns false if the ledger is
+//stale or the verification disagrees, in which case the caller should
+//fall back to a full scan.
+bool ledger_pick_victim(struct cgroup_context* cgc, uid_t& victim_uid,
+	std::vector<pid_t>& pids)
+{
+	struct ledger* l = cgc->ledger;
+	memory_t runner_up = 0;
+	memory_t max = 0;
+	if(!l) return(false);
+
+	pthread_mutex_lock(&l->lock);
+	if(l->users.empty() || l->generation == 0 ||
+		elapsed_ms(l->updated) > 3 * (uint64_t)l->interval_ms + 1000)
+	{
+		pthread_mutex_unlock(&l->lock);
+		return(false);
+	}
+	for(std::map<uid_t, ledger_user>::iterator i = l->users.begin();
+		i != l->users.end();
+		i++)
+	{
+		if(i->second.rss >= max)
+		{
+			runner_up = max;
+			max = i->second.rss;
+			victim_uid = i->first;
+		}
+		else if(i->second.rss > runner_up)
+		{
+			runner_up = i->second.rss;
+		}
+	}
+	std::vector<pid_t> candidates;
+	for(std::map<pid_t, ledger_entry>::iterator i = l->procs.begin();
+		i != l->procs.end();
+		i++)
+	{
+		if(i->second.uid == victim_uid)
+			candidates.push_back(i->first);
+	}
+	pthread_mutex_unlock(&l->lock);
+
+	memory_t verified = 0;
+	pids.clear();
+	for(std::vector<pid_t>::iterator i = candidates.begin();
+		i != candidates.end();
+		i++)
+	{
+		struct task_status ts;
+		if(read_task_status(*i, &ts) != 0 || ts.uid != victim_uid) continue;
+		verified += ts.rss;
+		pids.push_back(*i);
+	}
+	if(pids.empty() || verified < runner_up)
+	{
+		slog(LOG_INFO, "Ledger victim UID %u not confirmed (%llu kB vs %llu kB)\n",
+			victim_uid, (unsigned long long)verified,
+			(unsigned long long)runner_up);
+		return(false);
+	}
+	return(true);
+}
+
+//drop pids we just killed so the next pick doesn't choose them again
+void ledger_forget(struct cgroup_context* cgc, const std::vector<pid_t>& pids)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	for(std::vector<pid_t>::const_iterator i = pids.begin(); i != pids.end(); i++)
+	{
+		std::map<pid_t, ledger_entry>::iterator e = l->procs.find(*i);
+		if(e != l->procs.end())
+			ledger_remove(l, e);
+	}
+	pthread_mutex_unlock(&l->lock);
+}
+
+//Incremental updates from the proc connector. A forked child inherits
+//its parent's cgroup and uid, so it is only tracked if the parent is;
+//its RSS is filled in by the next sample or by verification.
+void ledger_track_fork(struct cgroup_context* cgc, pid_t parent, pid_t child)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	std::map<pid_t, ledger_entry>::iterator p = l->procs.find(parent);
+	if(p != l->procs.end() && l->procs.find(child) == l->procs.end())
+		ledger_insert(l, child, p->second.uid, 0, l->generation);
+	pthread_mutex_unlock(&l->lock);
+}
+
+void ledger_track_uid(struct cgroup_context* cgc, pid_t pid, uid_t uid)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	std::map<pid_t, ledger_entry>::iterator e = l->procs.find(pid);
+	if(e != l->procs.end() && e->second.uid != uid)
+	{
+		memory_t rss = e->second.rss;
+		ledger_remove(l, e);
+		ledger_insert(l, pid, uid, rss, l->generation);
+	}
+	pthread_mutex_unlock(&l->lock);
+}
+
+void ledger_track_exit(struct cgroup_context* cgc, pid_t pid)
+{
+	struct ledger* l = cgc->ledger;
+	if(!l) return;
+	pthread_mutex_lock(&l->lock);
+	std::map<pid_t, ledger_entry>::iterator e = l->procs.find(pid);
+	if(e != l->procs.end())
+		ledger_remove(l, e);
+	pthread_mutex_unlock(&l->lock);
+}
@@ -29,72 +29,336 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdarg.h>
 #include <syslog.h>
-#ifndef _BSD_SOURCE
-#define _BSD_SOURCE //for struct dirent.d_type definitions
-#endif
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
 #include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <log.h>
 
-void slog(int priority, const char* format, ...)
+//Asynchronous mode: the thread which started it formats each message
+//into a slot of a preallocated single-producer ring and returns; a
+//logger thread drains the ring into syslog. Kill records are queued as
+//plain numbers and only formatted by the logger. Other threads (the
+//ledger, scan workers, the proc connector) aren't on the kill path and
+//keep logging synchronously. A full ring drops the record and counts it.
+#define LOG_RECORD_TEXT 248
+
+#define RECORD_TEXT 0
+#define RECORD_KILL 1
+
+struct kill_record
+{
+	uid_t uid;
+	pid_t pid;
+	uint64_t rss;
+	uint64_t cgroup;
+};
+
+struct log_record
+{
+	int priority;
+	int kind;
+	union
+	{
+		char text[LOG_RECORD_TEXT];
+		struct kill_record kill;
+	};
+};
+
+static struct log_record* ring = NULL;
+static unsigned long ring_mask;
+static unsigned long ring_head; //advanced by the producer only
+static unsigned long ring_tail; //advanced by the logger only
+static unsigned long dropped;
+static pthread_t producer;
+static pthread_t logger;
+static sem_t ring_sem;
+static volatile char logger_stop;
+
+static void open_log()
 {
-	va_list args;
 	static char log_open = 0;
-	va_start(args, format);
 	if(!log_open)
 	{
 		log_open = 1;
 		openlog("userspace-oomkiller", LOG_NDELAY|LOG_PERROR|LOG_PID, LOG_DAEMON);
 	}
-	vsyslog(priority, format, args);
-	va_end(args);
 }
 
-void log_pid(char* name)
+//The next free slot, or NULL if the caller should log synchronously or
+//the ring is full (then the record is counted as dropped)
+static struct log_record* ring_claim(int* sync)
+{
+	*sync = !ring || !pthread_equal(pthread_self(), producer);
+	if(*sync) return(NULL);
+	if(ring_head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) > ring_mask)
+	{
+		__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+		return(NULL);
+	}
+	return(&ring[ring_head & ring_mask]);
+}
+
+static void ring_publish()
+{
+	__atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+	sem_post(&ring_sem);
+}
+
+//Kill records carry the inode of the victim's cgroup; its path is looked
+//up by whoever formats the line, the logger thread in async mode. The
+//lookup table holds every cgroup under the root, sorted by inode, and
+//is rebuilt on a miss at most once a second (a victim's cgroup may have
+//been removed by the time its line is written).
+struct cgroup_dir
 {
-	char* path;
-	FILE* fd;
-	asprintf(&path, "/proc/%s/stat", name);
-	fd = fopen(path, "r");
-	if(fd==0) return; //process probably died while we were inspecting it
-	char buf[4097];
-	size_t ret;
-	while(1)
+	uint64_t ino;
+	char* path; //relative to the root, "/" for the root itself
+};
+
+static char* cgroup_root = NULL;
+static struct cgroup_dir* dirs = NULL;
+static size_t ndirs, dirs_size;
+static time_t dirs_built; //CLOCK_MONOTONIC seconds
+static char dirs_valid; //built since the root was set
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_dir(uint64_t ino, const char* path)
+{
+	if(ndirs == dirs_size)
+	{
+		size_t size = dirs_size ? dirs_size * 2 : 256;
+		struct cgroup_dir* d = realloc(dirs, size * sizeof(struct cgroup_dir));
+		if(!d) return;
+		dirs = d;
+		dirs_size = size;
+	}
+	dirs[ndirs].ino = ino;
+	dirs[ndirs].path = strdup(path);
+	ndirs++;
+}
+
+//dirfd is closed; d_ino is the cgroup's inode, so nothing is stat()ed
+//unless the filesystem leaves d_type unset
+static void list_dirs(int dirfd, const char* path)
+{
+	DIR* dir = fdopendir(dirfd);
+	struct dirent* de;
+	if(!dir)
+	{
+		close(dirfd);
+		return;
+	}
+	while((de = readdir(dir)))
 	{
-		ret=fread(buf, 1, 4096, fd);
-		buf[ret] = '\0';
-		slog(LOG_INFO, "%s", buf);
-		if(ret < 4096) break;
+		if(de->d_name[0] == '.') continue;
+		unsigned char type = de->d_type;
+		if(type == DT_UNKNOWN)
+		{
+			struct stat st;
+			if(fstatat(dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+				S_ISDIR(st.st_mode))
+				type = DT_DIR;
+		}
+		if(type != DT_DIR) continue;
+		char* child;
+		if(asprintf(&child, "%s/%s", path[1] ? path : "", de->d_name) < 0) continue;
+		add_dir(de->d_ino, child);
+		int fd = openat(dirfd, de->d_name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if(fd >= 0)
+			list_dirs(fd, child);
+		free(child);
 	}
-	fclose(fd);
-	free(path);	
+	closedir(dir);
+}
+
+static int cgroup_dir_cmp(const void* a, const void* b)
+{
+	uint64_t x = ((const struct cgroup_dir*)a)->ino;
+	uint64_t y = ((const struct cgroup_dir*)b)->ino;
+	return(x < y ? -1 : x > y);
 }
 
-void log_process_table()
+static void build_dirs(time_t now)
 {
-	DIR* proc = opendir("/proc");
-	struct dirent* e;
-	size_t len;
-	char is_pid;
+	struct stat st;
 	size_t i;
-	while((e=readdir(proc))!=NULL)
+	for(i = 0; i < ndirs; i++)
+		free(dirs[i].path);
+	ndirs = 0;
+	dirs_built = now;
+	dirs_valid = 1;
+	int fd = open(cgroup_root, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(fd < 0) return;
+	if(fstat(fd, &st) == 0)
+		add_dir(st.st_ino, "/");
+	list_dirs(fd, "/");
+	qsort(dirs, ndirs, sizeof(struct cgroup_dir), cgroup_dir_cmp);
+}
+
+//Writes the path of the cgroup with inode ino into buf; 0 if found
+static int cgroup_path(uint64_t ino, char* buf, size_t size)
+{
+	struct cgroup_dir key, *d = NULL;
+	struct timespec ts;
+	key.ino = ino;
+	pthread_mutex_lock(&dirs_lock);
+	if(cgroup_root)
+	{
+		if(ndirs)
+			d = bsearch(&key, dirs, ndirs, sizeof(struct cgroup_dir), cgroup_dir_cmp);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if(!d && (!dirs_valid || ts.tv_sec > dirs_built))
+		{
+			build_dirs(ts.tv_sec);
+			d = bsearch(&key, dirs, ndirs, sizeof(struct cgroup_dir), cgroup_dir_cmp);
+		}
+		if(d)
+			snprintf(buf, size, "%s", d->path);
+	}
+	pthread_mutex_unlock(&dirs_lock);
+	return(d ? 0 : -1);
+}
+
+//Where the inodes of slog_kill() are looked up, usually the mount point of
+//the memory hierarchy
+void log_cgroup_root(const char* path)
+{
+	pthread_mutex_lock(&dirs_lock);
+	free(cgroup_root);
+	cgroup_root = strdup(path);
+	dirs_valid = 0;
+	pthread_mutex_unlock(&dirs_lock);
+}
+
+static void log_kill(const struct kill_record* k)
+{
+	char path[4096];
+	if(k->cgroup && cgroup_path(k->cgroup, path, sizeof(path)) == 0)
+		syslog(LOG_ALERT, "killing UID:%u PID %d, %llu kB; cgroup %s",
+			k->uid, k->pid, (unsigned long long)k->rss, path);
+	else if(k->cgroup)
+		syslog(LOG_ALERT, "killing UID:%u PID %d, %llu kB; cgroup inode %llu",
+			k->uid, k->pid, (unsigned long long)k->rss,
+			(unsigned long long)k->cgroup);
+	else
+		syslog(LOG_ALERT, "killing UID:%u PID %d", k->uid, k->pid);
+}
+
+void slog(int priority, const char* format, ...)
+{
+	int sync;
+	va_list args;
+	va_start(args, format);
+	struct log_record* r = ring_claim(&sync);
+	if(r)
+	{
+		r->priority = priority;
+		r->kind = RECORD_TEXT;
+		vsnprintf(r->text, LOG_RECORD_TEXT, format, args);
+		ring_publish();
+	}
+	else if(sync)
+	{
+		open_log();
+		vsyslog(priority, format, args);
+	}
+	va_end(args);
+}
+
+void slog_kill(uid_t uid, pid_t pid, uint64_t rss, uint64_t cgroup)
+{
+	int sync;
+	struct log_record* r = ring_claim(&sync);
+	struct kill_record k = { uid, pid, rss, cgroup };
+	if(r)
+	{
+		r->priority = LOG_ALERT;
+		r->kind = RECORD_KILL;
+		r->kill = k;
+		ring_publish();
+	}
+	else if(sync)
+	{
+		open_log();
+		log_kill(&k);
+	}
+}
+
+static void* log_drain(void* arg)
+{
+	struct log_record* slots = arg; //ring is cleared before we're stopped
+	unsigned long reported = 0;
+	unsigned long head, d;
+	for(;;)
 	{
-		if(e->d_type != DT_DIR) continue;
-		len = strlen(e->d_name);
-		is_pid = 1; 
-		for(i=0;i<len;i++)
+		sem_wait(&ring_sem);
+		head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+		while(ring_tail != head)
+		{
+			struct log_record* r = &slots[ring_tail & ring_mask];
+			if(r->kind == RECORD_KILL)
+				log_kill(&r->kill);
+			else
+				syslog(r->priority, "%s", r->text);
+			__atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_RELEASE);
+		}
+		d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+		if(d != reported)
 		{
-			if(!isdigit((e->d_name)[i]))
-				is_pid = 0;
+			syslog(LOG_WARNING, "%lu log records dropped, ring full", d - reported);
+			reported = d;
 		}
-		if(is_pid)
-			log_pid(e->d_name);
+		if(logger_stop && ring_tail == __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE))
+			break;
+	}
+	return(NULL);
+}
+
+//Routes the calling thread's slog() through a ring of at least records
+//slots (rounded up to a power of two). Returns 0, or -1 and stays
+//synchronous.
+int log_async_start(unsigned long records)
+{
+	unsigned long size = 1;
+	if(ring) return(0);
+	while(size < records) size <<= 1;
+	open_log();
+	ring = calloc(size, sizeof(struct log_record));
+	if(!ring) return(-1);
+	ring_mask = size - 1;
+	ring_head = ring_tail = dropped = 0;
+	logger_stop = 0;
+	producer = pthread_self();
+	sem_init(&ring_sem, 0, 0);
+	if(pthread_create(&logger, NULL, log_drain, ring) != 0)
+	{
+		free(ring);
+		ring = NULL;
+		return(-1);
 	}
-	closedir(proc);
-}
\ No newline at end of file
+	return(0);
+}
+
+//Drains whatever is queued and goes back to synchronous logging
+void log_async_stop()
+{
+	struct log_record* r = ring;
+	if(!r || !pthread_equal(pthread_self(), producer)) return;
+	ring = NULL;
+	logger_stop = 1;
+	sem_post(&ring_sem);
+	pthread_join(logger, NULL);
+	sem_destroy(&ring_sem);
+	free(r);
+}
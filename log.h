@@ -32,12 +32,21 @@
 #ifndef __LOG_H__
 #define __LOG_H__
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void slog(int, const char*, ...);
-void log_process_table();
+//Logs a killed task; rss (kB) and cgroup (its inode) are 0 if unknown.
+//In async mode only the numbers are queued; the logger formats them,
+//looking the inode up under the root given to log_cgroup_root().
+void slog_kill(uid_t uid, pid_t pid, uint64_t rss, uint64_t cgroup);
+void log_cgroup_root(const char* path);
+int log_async_start(unsigned long records);
+void log_async_stop();
 #ifdef __cplusplus
 }
 #endif
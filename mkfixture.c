@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Builds a synthetic procfs and cgroup tree (see fixture.h). The daemon
+//can then be pointed at it with
+//  oomkiller -o <dir>/proc -G <dir>/cgroup -g <name> ...
+//usage: mkfixture [-n name] [-u users] [-j jobs] [-d depth] [-s seed] <dir> <tasks>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fixture.h>
+
+int main(int argc, char** argv)
+{
+	struct fixture_spec spec = { "oom", 16, 4, 1, 0, 1 };
+	int ch;
+	while((ch = getopt(argc, argv, "n:u:j:d:s:")) != -1)
+	{
+		switch(ch)
+		{
+			case 'n':
+				spec.name = optarg;
+				break;
+			case 'u':
+				spec.users = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				spec.jobs = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				spec.depth = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				spec.seed = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n name] [-u users] [-j jobs] [-d depth] "
+					"[-s seed] <dir> <tasks>\n", argv[0]);
+				return(2);
+		}
+	}
+	if(argc - optind != 2)
+	{
+		fprintf(stderr, "usage: %s [-n name] [-u users] [-j jobs] [-d depth] "
+			"[-s seed] <dir> <tasks>\n", argv[0]);
+		return(2);
+	}
+	spec.tasks = strtoul(argv[optind + 1], NULL, 10);
+	return(fixture_build(argv[optind], &spec) == 0 ? 0 : 1);
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Times victim selection against synthetic trees (see fixture.h), so the
+//scanner can be measured without root or a real OOM. For each task count
+//it builds a fixture, then repeatedly
+//  scan:   scan_units() in a fresh event loop epoch, a full walk of the
+//          hierarchy and every task's status file
+//  select: find_victim() in the same epoch, which reuses that scan and
+//          scores, picks and "kills" (fixture pids can't exist, so no
+//          signal is ever delivered, and the victims aren't tracked)
+//and reports the median time and the heap allocations of each.
+//usage: oombench [-u users] [-j jobs] [-d depth] [-r repeats]
+//	[-t scan_threads] [-a rss|cgroup|pss] [-k dir] [tasks ...]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include <cgroup_context.h>
+#include <event_loop.h>
+
+#include <proc_status.h>
+#include <snapshot.h>
+#include <scan_pool.h>
+#include <accounting.h>
+#include <latency.h>
+#include <fixture.h>
+
+extern "C"
+{
+int find_victim(struct cgroup_context* cgc);
+
+//Every malloc, calloc and realloc in the process (operator new included)
+//goes through these, so the scanner's allocations can be counted
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+static unsigned long allocations;
+
+void* malloc(size_t size) __THROW
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return(__libc_malloc(size));
+}
+
+void* calloc(size_t n, size_t size) __THROW
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return(__libc_calloc(n, size));
+}
+
+void* realloc(void* p, size_t size) __THROW
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return(__libc_realloc(p, size));
+}
+
+//nothing here waits for victims or watches usage
+void oom_check(struct cgroup_context* cgc, char force)
+{
+}
+
+void usage_warning(struct cgroup_context* cgc, char above)
+{
+}
+}
+
+static char bench_is_oom(struct cgroup_context* cgc)
+{
+	return(1);
+}
+
+static void bench_tasks(struct cgroup_context* cgc, const pid_t* pids, size_t n)
+{
+}
+
+static int bench_memory_usage(struct cgroup_context* cgc, uint64_t* usage, uint64_t* limit)
+{
+	*usage = 0;
+	*limit = UINT64_MAX;
+	return(0);
+}
+
+//freezing and killing cost nothing, so only the daemon's own work is timed
+static const struct cgroup_backend bench_backend = {
+	"bench", NULL, NULL, bench_is_oom, bench_tasks, bench_tasks,
+	NULL, NULL, NULL, bench_memory_usage
+};
+
+struct result
+{
+	double scan_ms;
+	double select_ms;
+	unsigned long scan_allocs;
+	unsigned long select_allocs;
+	size_t units;
+};
+
+static double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	return(v.empty() ? 0 : v[v.size() / 2]);
+}
+
+static int run(const char* dir, const struct fixture_spec& spec, unsigned int repeats,
+	struct result& res)
+{
+	char* path;
+	asprintf(&path, "%s/proc", dir);
+	set_proc_root(path);
+	free(path);
+	struct cgroup_context cgc;
+	memset(&cgc, 0, sizeof(cgc));
+	cgc.backend = &bench_backend;
+	asprintf(&cgc.cgroup_path, "%s/cgroup", dir);
+	cgc.cgroup_name = (char*)spec.name;
+	std::vector<double> scan, select;
+	for(unsigned int r = 0; r < repeats; r++)
+	{
+		struct snapshot snap;
+		std::map<uint64_t, user_usage> units;
+		event_loop_run_once(0); //new epoch: nothing cached from the last round
+		unsigned long allocs = allocations;
+		uint64_t start = latency_now();
+		if(!scan_units(&cgc, snap, units, false))
+		{
+			free(cgc.cgroup_path);
+			return(-1);
+		}
+		scan.push_back((latency_now() - start) / 1e6);
+		res.scan_allocs = allocations - allocs;
+		res.units = units.size();
+		allocs = allocations;
+		start = latency_now();
+		find_victim(&cgc);
+		select.push_back((latency_now() - start) / 1e6);
+		res.select_allocs = allocations - allocs;
+	}
+	res.scan_ms = median(scan);
+	res.select_ms = median(select);
+	free(cgc.cgroup_path);
+	return(0);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-u users] [-j jobs] [-d depth] [-r repeats] "
+		"[-t scan_threads] [-a rss|cgroup|pss] [-k dir] [tasks ...]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	struct fixture_spec spec = { "oom", 64, 8, 1, 0, 1 };
+	unsigned int repeats = 5;
+	unsigned int threads = 1;
+	const char* keep = NULL;
+	int ch;
+	while((ch = getopt(argc, argv, "u:j:d:r:t:a:k:")) != -1)
+	{
+		switch(ch)
+		{
+			case 'u':
+				spec.users = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				spec.jobs = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				spec.depth = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				repeats = strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				if(strcmp(optarg, "cgroup") == 0)
+					set_accounting_mode(ACCOUNT_CGROUP);
+				else if(strcmp(optarg, "pss") == 0)
+					set_accounting_mode(ACCOUNT_PSS);
+				else
+					set_accounting_mode(ACCOUNT_RSS);
+				break;
+			case 'k':
+				keep = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return(2);
+		}
+	}
+	std::vector<unsigned int> sizes;
+	for(int i = optind; i < argc; i++)
+		sizes.push_back(strtoul(argv[i], NULL, 10));
+	if(sizes.empty())
+	{
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+	}
+	if(repeats == 0) repeats = 1;
+
+	setlogmask(LOG_UPTO(LOG_ERR)); //find_victim() reports every kill
+	if(event_loop_init() != 0)
+	{
+		fprintf(stderr, "Failed to create event loop\n");
+		return(1);
+	}
+	if(threads > 1)
+		scan_pool_start(threads);
+	//each repeat would otherwise find the last one's victims still
+	//"exiting", and polling them would count towards select_ms
+	set_victim_tracking(false);
+	printf("%9s %7s %7s %10s %10s %12s %12s\n", "tasks", "units", "build_s",
+		"scan_ms", "select_ms", "scan_allocs", "select_allocs");
+	int ret = 0;
+	for(size_t i = 0; i < sizes.size(); i++)
+	{
+		char dir[4096];
+		if(keep)
+		{
+			mkdir(keep, 0755);
+			snprintf(dir, sizeof(dir), "%s/%u", keep, sizes[i]);
+		}
+		else
+		{
+			snprintf(dir, sizeof(dir), "/tmp/oombench.XXXXXX");
+			if(!mkdtemp(dir))
+			{
+				perror("mkdtemp");
+				ret = 1;
+				break;
+			}
+		}
+		spec.tasks = sizes[i];
+		struct result res;
+		memset(&res, 0, sizeof(res));
+		uint64_t start = latency_now();
+		int built = fixture_build(dir, &spec);
+		double build_s = (latency_now() - start) / 1e9;
+		if(built != 0 || run(dir, spec, repeats, res) != 0)
+		{
+			fprintf(stderr, "Benchmark of %u tasks failed\n", sizes[i]);
+			ret = 1;
+		}
+		else
+		{
+			printf("%9u %7zu %7.1f %10.3f %10.3f %12lu %12lu\n", sizes[i], res.units,
+				build_s, res.scan_ms, res.select_ms, res.scan_allocs, res.select_allocs);
+			fflush(stdout);
+		}
+		if(!keep)
+			fixture_remove(dir);
+	}
+	scan_pool_stop();
+	event_loop_exit();
+	return(ret);
+}
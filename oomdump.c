@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Decodes the process-table snapshots written by proc_table.c.
+//usage: oomdump <file> [seq]
+//Prints every stored snapshot oldest first, or only the one numbered seq.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <proc_table.h>
+
+static void print_slot(const struct proc_table_slot* s, const struct proc_record* r)
+{
+	char when[64];
+	time_t t = s->time;
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("snapshot %llu at %s, cgroup %s, %u tasks",
+		(unsigned long long)s->seq, when, s->cgroup, s->seen);
+	if(s->seen > s->count)
+		printf(" (%u stored)", s->count);
+	printf("\n%8s %8s %8s %s %12s %12s %14s\n",
+		"PID", "PPID", "UID", "S", "RSS_KB", "CGROUP", "START");
+	uint32_t i;
+	for(i = 0; i < s->count; i++)
+		printf("%8d %8d %8u %c %12llu %12llu %14llu\n",
+			r[i].pid, r[i].ppid, r[i].uid, r[i].state,
+			(unsigned long long)r[i].rss, (unsigned long long)r[i].cgroup,
+			(unsigned long long)r[i].starttime);
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "usage: %s <file> [seq]\n", argv[0]);
+		return(2);
+	}
+	unsigned long long want = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+	FILE* f = fopen(argv[1], "r");
+	if(!f)
+	{
+		perror(argv[1]);
+		return(1);
+	}
+	struct proc_table_header h;
+	if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, PROC_TABLE_MAGIC, 8) != 0 ||
+		h.record_size != sizeof(struct proc_record))
+	{
+		fprintf(stderr, "%s: not a process table snapshot\n", argv[1]);
+		return(1);
+	}
+	char* slots = malloc(h.slots * h.slot_size);
+	if(!slots || fread(slots, h.slot_size, h.slots, f) != h.slots)
+	{
+		fprintf(stderr, "%s: truncated\n", argv[1]);
+		return(1);
+	}
+	fclose(f);
+	//the slot after the newest is the oldest
+	uint32_t i;
+	for(i = 0; i < h.slots; i++)
+	{
+		const struct proc_table_slot* s = (const struct proc_table_slot*)
+			(slots + ((h.next + i) % h.slots) * h.slot_size);
+		if(s->seq == 0 || (want && s->seq != want)) continue;
+		if(s->count > h.max_records) continue; //damaged
+		print_slot(s, (const struct proc_record*)(s + 1));
+	}
+	free(slots);
+	return(0);
+}
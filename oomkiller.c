@@ -33,7 +33,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/eventfd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
@@ -47,12 +46,24 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <execinfo.h>
-
-#include <libcgroup.h>
+#include <sys/resource.h>
 
 #include <cgroup_context.h>
 
 #include <log.h>
+#include <event_loop.h>
+
+#include <ledger.h>
+#include <proc_events.h>
+#include <scan_pool.h>
+#include <proc_status.h>
+#include <proc_uring.h>
+#include <psi.h>
+#include <accounting.h>
+#include <trend.h>
+#include <proc_table.h>
+#include <latency.h>
+#include <control.h>
 
 void exit_handler(int);
 void crash_handler(int);
@@ -60,12 +71,39 @@ void crash_handler(int);
 static volatile sig_atomic_t exit_flag;
 static volatile sig_atomic_t restart_flag;
 static jmp_buf exit_stack;
+static char verbose_log = 0;
 
-void start_oomkiller(struct cgroup_context* cgc);
-void stop_oomkiller(struct cgroup_context* cgc);
 int find_victim(struct cgroup_context* cgc);
-void kill_victim(struct cgroup_context* cgc, uid_t victim_uid);
-char is_oom(struct cgroup_context* cgc);
+static void oom_event(struct event_source* src, uint32_t events);
+static void kill_or_recover(struct cgroup_context* cgc, char oom);
+static void arm_victim_timer(struct cgroup_context* cgc);
+static void victim_timeout(struct event_source* src, uint32_t events);
+static void psi_event(struct event_source* src, uint32_t events);
+static void system_psi_event(struct event_source* src, uint32_t events);
+
+static void add_cgroup_name(char*** names, int* n, const char* name);
+static int read_config(const char* path, char*** names, int* n);
+
+//how long to wait for victims to exit before re-checking memory state
+#define VICTIM_TIMEOUT_MS 1000
+//sampling interval of a ledger started by a usage threshold
+#define WARM_SAMPLE_MS 1000
+//growth sampling interval which keeps the PSS cache warm without -R
+#define PSS_WARM_MS 10000
+#define MAX_THRESHOLDS 8
+//control socket rescan interval when no -s sampling interval is given
+#define CONTROL_SCAN_MS 5000
+//async log ring slots, 256 bytes each
+#define LOG_RING_RECORDS 4096
+//process table snapshots kept, and tasks per snapshot (40 bytes each)
+#define SNAPSHOT_SLOTS 8
+#define SNAPSHOT_RECORDS 65536
+#define DEFAULT_SNAPSHOT_FILE "/var/tmp/oomkiller.snap"
+
+//Contexts whose cgroup has no memory.pressure (v1) share one trigger on
+//the system-wide pressure; data is the contexts array
+static struct event_source system_psi = { -1, system_psi_event, NULL };
+static int system_psi_contexts;
 
 int main(int argc, char** argv)
 {
@@ -75,28 +113,57 @@ int main(int argc, char** argv)
 		{ "pidfile", required_argument, NULL, 'p'},
 		{ "restart_on_crash", no_argument, NULL, 'r'},
 		{ "verbose", no_argument, NULL, 'v'}, 
+		{ "sample_interval", required_argument, NULL, 's'},
+		{ "proc_events", no_argument, NULL, 'n'},
+		{ "scan_threads", required_argument, NULL, 'j'},
+		{ "io_uring", no_argument, NULL, 'u'},
+		{ "psi", required_argument, NULL, 'P'},
+		{ "config", required_argument, NULL, 'c'},
+		{ "thresholds", required_argument, NULL, 't'},
+		{ "accounting", required_argument, NULL, 'a'},
+		{ "key", required_argument, NULL, 'k'},
+		{ "rate_interval", required_argument, NULL, 'R'},
+		{ "rate_weight", required_argument, NULL, 'w'},
+		{ "swap_weight", required_argument, NULL, 'W'},
+		{ "minimal_kill", required_argument, NULL, 'm'},
+		{ "minimal_deadline", required_argument, NULL, 'D'},
+		{ "async_log", no_argument, NULL, 'A'},
+		{ "snapshot", required_argument, NULL, 'S'},
+		{ "listen", required_argument, NULL, 'l'},
+		{ "proc_root", required_argument, NULL, 'o'},
+		{ "cgroup_root", required_argument, NULL, 'G'},
 		{ NULL, 0, NULL, 0}
 	};
 
-	int cl;
-	char* event_command;
-	char* event_control_path;	
-	char* oom_control_path;
 	char* pidfile = NULL;
-	uint64_t efdcounter;
 	struct sigaction sa;
-	int flag;
 	assert(argc > 1);
 	exit_flag = 0;
 	restart_flag = 0;
 	char daemon_flag = 0;
 	char restart_on_crash_flg = 0;
-	struct cgroup_context cgc;
-	char verbose_log = 0;
-	cgc.cgroup_name = NULL;
+	struct cgroup_context* contexts;
+	char** cgroup_names = NULL;
+	int ncontexts = 0;
+	int i;
+	unsigned int sample_interval = 0; //ms, 0 disables the ledger
+	char proc_events_flag = 0;
+	unsigned int scan_threads = 1;
+	char io_uring_flag = 0;
+	char* psi_trigger = NULL; //e.g. "some 150000 1000000"
+	unsigned int thresholds[MAX_THRESHOLDS]; //percent of the limit
+	int nthresholds = 0;
+	unsigned int rate_interval = 0; //ms, 0: no growth tracking
+	unsigned int rate_weight = 0;
+	unsigned int swap_weight = 0;
+	unsigned int minimal_headroom = 0; //MB, 0: kill the whole victim
+	unsigned int minimal_deadline = 5000; //ms
+	char async_log_flag = 0;
+	char* snapshot_file = NULL;
+	char* control_path = NULL;
 
 	int ch;
-	while((ch = getopt_long(argc, argv, "rvdg:p:", longopts, NULL)) != -1)
+	while((ch = getopt_long(argc, argv, "rvnudAg:p:s:j:P:c:t:a:k:R:w:W:m:D:S:l:o:G:", longopts, NULL)) != -1)
 	{
 		switch(ch)
 		{
@@ -104,7 +171,14 @@ int main(int argc, char** argv)
 				daemon_flag = 1;
 				break;
 			case 'g':
-				asprintf(&cgc.cgroup_name, "%s", optarg);
+				add_cgroup_name(&cgroup_names, &ncontexts, optarg);
+				break;
+			case 'c':
+				if(read_config(optarg, &cgroup_names, &ncontexts) != 0)
+				{
+					slog(LOG_ALERT, "FATAL: failed to read config %s", optarg);
+					abort();
+				}
 				break;
 			case 'p':
 				asprintf(&pidfile, "%s", optarg);
@@ -115,15 +189,149 @@ int main(int argc, char** argv)
 			case 'v':
 				verbose_log = 1;
 				break;
+			case 's':
+				sample_interval = strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				proc_events_flag = 1;
+				break;
+			case 'j':
+				scan_threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'u': //off by default, slower than plain reads so far
+				io_uring_flag = 1;
+				break;
+			case 't':
+			{
+				char* p = optarg;
+				while(*p && nthresholds < MAX_THRESHOLDS)
+				{
+					unsigned int pct = strtoul(p, &p, 10);
+					if(pct > 0 && pct < 100)
+						thresholds[nthresholds++] = pct;
+					if(*p) p++; //skip the comma
+				}
+				break;
+			}
+			case 'a':
+				if(strcmp(optarg, "cgroup") == 0)
+					set_accounting_mode(ACCOUNT_CGROUP);
+				else if(strcmp(optarg, "rss") == 0)
+					set_accounting_mode(ACCOUNT_RSS);
+				else if(strcmp(optarg, "pss") == 0)
+					set_accounting_mode(ACCOUNT_PSS);
+				else
+				{
+					slog(LOG_ALERT, "FATAL: unknown accounting mode %s", optarg);
+					abort();
+				}
+				break;
+			case 'k':
+				if(strcmp(optarg, "uid") == 0)
+					set_aggregation_key(KEY_UID, 0);
+				else if(strncmp(optarg, "job", 3) == 0 &&
+					(optarg[3] == '\0' || optarg[3] == ':'))
+					set_aggregation_key(KEY_JOB, optarg[3] ?
+						strtoul(optarg + 4, NULL, 10) : 0);
+				else if(strcmp(optarg, "session") == 0)
+					set_aggregation_key(KEY_SESSION, 0);
+				else if(strcmp(optarg, "pgrp") == 0)
+					set_aggregation_key(KEY_PGRP, 0);
+				else
+				{
+					slog(LOG_ALERT, "FATAL: unknown aggregation key %s", optarg);
+					abort();
+				}
+				break;
+			case 'R':
+				rate_interval = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				rate_weight = strtoul(optarg, NULL, 10);
+				break;
+			case 'W':
+				swap_weight = strtoul(optarg, NULL, 10);
+				break;
+			case 'm':
+				minimal_headroom = strtoul(optarg, NULL, 10);
+				break;
+			case 'D':
+				minimal_deadline = strtoul(optarg, NULL, 10);
+				break;
+			case 'A':
+				async_log_flag = 1;
+				break;
+			case 'S':
+				asprintf(&snapshot_file, "%s", optarg);
+				break;
+			case 'l':
+				asprintf(&control_path, "%s", optarg);
+				break;
+			case 'o':
+				set_proc_root(optarg);
+				break;
+			case 'G':
+				set_cgroup_root(optarg);
+				break;
+			case 'P':
+				asprintf(&psi_trigger, "%s", optarg);
+				break;
 			default:
 				break;
 		}
 	}
-	if(cgc.cgroup_name == NULL)
+	//cgroup accounting reads one process per cgroup, so it can't see
+	//sessions or process groups
+	if(get_accounting_mode() == ACCOUNT_CGROUP &&
+		(get_aggregation_key() == KEY_SESSION || get_aggregation_key() == KEY_PGRP))
+	{
+		slog(LOG_ALERT, "FATAL: session and pgrp keys need RSS accounting");
+		abort();
+	}
+	//they come from NSpgid and NSsid in status (4.1+), or else from stat;
+	//if neither can be read for this process, refuse rather than
+	//put every task in one unit
+	if(get_aggregation_key() == KEY_SESSION || get_aggregation_key() == KEY_PGRP)
+	{
+		struct task_status self;
+		if(read_task_status(getpid(), &self) == 0 &&
+			(self.found & (TS_PGID|TS_SID)) != (TS_PGID|TS_SID) &&
+			read_task_ids(getpid(), &self) != 0)
+		{
+			slog(LOG_ALERT, "FATAL: session and pgrp keys need NSpgid/NSsid in status, or stat");
+			abort();
+		}
+	}
+	//growth counts as much as this many seconds of it unless told otherwise
+	if(rate_interval && !rate_weight)
+		rate_weight = 30;
+	if(!rate_interval)
+		rate_weight = 0;
+	set_score_weights(rate_weight, swap_weight);
+	//smaps_rollup is too slow to read for every task once an OOM is under
+	//way; the growth sampler's scans go through the PSS cache, so keep
+	//one running (unweighted) to hold the cache warm
+	if(get_accounting_mode() == ACCOUNT_PSS && !rate_interval)
+		rate_interval = PSS_WARM_MS;
+	set_minimal_kill(minimal_headroom, minimal_deadline);
+	if(ncontexts == 0)
 	{
 		slog(LOG_ALERT, "FATAL: No cgroup specified, exiting");
 		abort();
 	}
+	//victims are waited on through one pidfd each; the default soft
+	//limit of 1024 would run out part way through a large kill
+	struct rlimit nofile;
+	if(getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max)
+	{
+		nofile.rlim_cur = nofile.rlim_max;
+		if(setrlimit(RLIMIT_NOFILE, &nofile) != 0)
+			slog(LOG_ERR, "Failed to raise the open file limit: %s", strerror(errno));
+	}
+	//connector events keep pid ownership current; the ledger's scan
+	//only needs to refresh RSS and pick up externally attached tasks
+	if(proc_events_flag && !sample_interval)
+		sample_interval = 5000;
 	if(daemon_flag)
 	{
 		if(daemon(0,0) == -1)
@@ -146,51 +354,98 @@ int main(int argc, char** argv)
 			pidfile = NULL;
 		}
 	}
-	cgc.efd = eventfd(0,0);
-	assert(cgc.efd != -1);
-
-	cgroup_init();
-	cgroup_get_subsys_mount_point("memory", &((cgc.cgroup_path)));
-	cgroup_get_subsys_mount_point("freezer", &((cgc.freezer_path)));
-
-	cgc.purgatory = cgroup_new_cgroup("purgatory");
-	cgroup_add_controller(cgc.purgatory, "freezer");
-	cgroup_create_cgroup(cgc.purgatory,1);
-
-	char* purgatory_freeze_path;
-	FILE* freezer_fd;
-	asprintf(&purgatory_freeze_path, "/%s/purgatory/freezer.state", cgc.freezer_path);
-	freezer_fd = fopen(purgatory_freeze_path,"w");
-	fprintf(freezer_fd, "FROZEN");
-	fclose(freezer_fd);
-	free(purgatory_freeze_path);
-
-	asprintf(&event_control_path, "/%s/%s/cgroup.event_control",
-			cgc.cgroup_path, cgc.cgroup_name);
-	cgc.ecfd = open(event_control_path, O_WRONLY);
-	if(cgc.ecfd < 0)
+	//after daemon(), whose fork would leave the logger thread behind
+	if(async_log_flag && log_async_start(LOG_RING_RECORDS) != 0)
+		slog(LOG_ERR, "Failed to start async logging, logging synchronously");
+	if(event_loop_init() != 0)
 	{
-		slog(LOG_ALERT, 
-			"FATAL: failed to open cgroup event control: %s\n",
-			 event_control_path);
-		perror("cgroup.event_control");
+		slog(LOG_ALERT, "FATAL: failed to create event loop");
+		abort();
 	}
-
-	asprintf(&oom_control_path, "/%s/%s/memory.oom_control",
-			cgc.cgroup_path, cgc.cgroup_name);
-	cgc.oomfd = open(oom_control_path, O_RDONLY);
-	if(!(cgc.oomfd >=0))
+	//one context per supervised cgroup, all driven by the same loop and
+	//sharing the scan pool, io_uring and proc connector
+	contexts = calloc(ncontexts, sizeof(struct cgroup_context));
+	const struct cgroup_backend* backend = cgroup_backend_detect();
+	slog(LOG_INFO, "Using %s backend", backend->name);
+	for(i = 0; i < ncontexts; i++)
 	{
-		slog(LOG_ALERT,
-			"FATAL: Failed to open oom_control");
-		abort();
+		struct cgroup_context* cgc = &contexts[i];
+		cgc->backend = backend;
+		cgc->cgroup_name = cgroup_names[i];
+		cgc->ledger = NULL;
+		cgc->ledger_on_demand = 0;
+		cgc->trend = NULL;
+		cgc->usage_source.fd = -1;
+		cgc->usagefd = -1;
+		cgc->limitfd = -1;
+		cgc->partial_kill = 0;
+		cgc->signalled = 0;
+		cgc->victims = 0;
+		cgc->handling = 0;
+		cgc->oom_source.handler = oom_event; //registered by the backend
+		cgc->oom_source.data = cgc;
+		if(timer_source_init(&cgc->victim_timer, victim_timeout, cgc) != 0)
+		{
+			slog(LOG_ALERT, "FATAL: failed to create victim timer");
+			abort();
+		}
+		if(backend->setup(cgc) != 0)
+		{
+			slog(LOG_ALERT, "FATAL: failed to set up cgroup backend for %s",
+				cgc->cgroup_name);
+			abort();
+		}
+		if(nthresholds)
+		{
+			if(backend->watch_usage)
+				backend->watch_usage(cgc, thresholds, nthresholds);
+			else
+				slog(LOG_ERR, "Usage thresholds need cgroup v1, ignoring");
+		}
+		cgc->psi_source.fd = -1;
+		cgc->psi_source.handler = psi_event;
+		cgc->psi_source.data = cgc;
+		if(psi_trigger)
+		{
+			cgc->psi_source.fd = psi_trigger_open(cgc, psi_trigger);
+			if(cgc->psi_source.fd < 0 && errno == ENOENT)
+			{
+				//node-wide pressure must not set off a kill in every
+				//context; one trigger picks a single cgroup instead
+				slog(LOG_INFO, "No memory.pressure for %s, sharing the system-wide trigger",
+					cgc->cgroup_name);
+				if(system_psi.fd < 0)
+				{
+					system_psi.fd = psi_trigger_open(NULL, psi_trigger);
+					system_psi.data = contexts;
+					system_psi_contexts = ncontexts;
+					if(system_psi.fd < 0 || event_loop_add(&system_psi, EPOLLPRI) != 0)
+					{
+						slog(LOG_ALERT, "FATAL: failed to register PSI trigger");
+						abort();
+					}
+				}
+			}
+			else if(cgc->psi_source.fd < 0 ||
+				event_loop_add(&cgc->psi_source, EPOLLPRI) != 0)
+			{
+				slog(LOG_ALERT, "FATAL: failed to register PSI trigger");
+				abort();
+			}
+		}
 	}
-
-	cl = asprintf(&event_command, "%d %d", cgc.efd, cgc.oomfd);
-	write(cgc.ecfd, event_command, cl);
-	free(event_control_path);
-	free(event_command);
-	free(oom_control_path);
+	//kill lines name each victim's cgroup by its path under here
+	log_cgroup_root(contexts[0].cgroup_path);
+	//-v used to dump /proc to syslog on every OOM; it now keeps binary
+	//snapshots instead, decoded with oomdump
+	if(verbose_log && !snapshot_file)
+		asprintf(&snapshot_file, "%s", DEFAULT_SNAPSHOT_FILE);
+	if(snapshot_file && proc_table_open(snapshot_file, SNAPSHOT_SLOTS,
+		SNAPSHOT_RECORDS, contexts[0].cgroup_path) != 0)
+		slog(LOG_ERR, "Process table snapshots disabled");
+	free(snapshot_file);
+	free(psi_trigger);
+	free(cgroup_names);
 	setjmp(exit_stack);
 
 	sigemptyset(&sa.sa_mask);
@@ -208,24 +463,58 @@ int main(int argc, char** argv)
 
 	if(restart_flag < 2) //try to handle recursive faults
 	{
-		stop_oomkiller(&cgc);
-		while(!exit_flag)
+		if(io_uring_flag && !proc_uring_enabled())
+			proc_uring_init(256);
+		if(scan_threads > 1 && scan_pool_threads() == 1)
+			scan_pool_start(scan_threads);
+		for(i = 0; i < ncontexts; i++)
 		{
-			read(cgc.efd, &efdcounter, sizeof(uint64_t));
-			flag = 0; //stop killing if the task list is empty (shouldn't happen)
-			if(verbose_log)
-				log_process_table(); //dump process list to syslog
-			while(is_oom(&cgc) && flag >= 0)
+			if(rate_interval && !contexts[i].trend)
+				trend_start(&contexts[i], rate_interval);
+			if(sample_interval && !contexts[i].ledger)
 			{
-				flag = find_victim(&cgc);
-				usleep(100); //give processes a chance to die
+				if(ledger_start(&contexts[i], sample_interval) == 0 &&
+					proc_events_flag)
+					proc_events_start(&contexts[i]);
 			}
 		}
-		cgroup_delete_cgroup(cgc.purgatory, 0);
-		start_oomkiller(&cgc);
-		close(cgc.oomfd);
-		close(cgc.ecfd);
+		if(control_path && control_start(control_path, contexts, ncontexts,
+			sample_interval ? sample_interval : CONTROL_SCAN_MS) != 0)
+			slog(LOG_ERR, "Control socket %s unavailable", control_path);
+		//Everything from here on happens in event handlers: oom_event()
+		//when the backend signals OOM, the victims' pidfd handlers as they
+		//exit, and victim_timeout() if they take too long.
+		while(!exit_flag)
+		{
+			event_loop_run_once(-1);
+		}
+		control_stop();
+		proc_events_stop();
+		for(i = 0; i < ncontexts; i++)
+		{
+			ledger_stop(&contexts[i]);
+			trend_stop(&contexts[i]);
+		}
+		scan_pool_stop();
+		proc_uring_exit();
+		for(i = 0; i < ncontexts; i++)
+		{
+			struct cgroup_context* cgc = &contexts[i];
+			cgc->backend->teardown(cgc);
+			if(cgc->psi_source.fd >= 0)
+				close(cgc->psi_source.fd);
+			close(cgc->victim_timer.fd);
+		}
+		if(system_psi.fd >= 0)
+		{
+			close(system_psi.fd);
+			system_psi.fd = -1;
+		}
+		event_loop_exit();
 	}
+	latency_log();
+	proc_table_close();
+	log_async_stop();
 	if(restart_flag)
 	{
 		char* args[argc+1];
@@ -240,23 +529,236 @@ int main(int argc, char** argv)
 	}
 }
 
-//NOTE: will only work if memory.use_hierarchy=0 in root cgroup
-//(can be 1 in nested groups)
-void stop_oomkiller(struct cgroup_context* cgc)
+//Called whenever something may have changed: an OOM event, the last
+//victim exiting (force = 0) or the victim timer expiring (force = 1).
+//Kills the next victim if the cgroup is still under OOM.
+void oom_check(struct cgroup_context* cgc, char force)
+{
+	if(!cgc->handling) return;
+	if(cgc->victims > 0)
+	{
+		if(!force) return; //wait for them to exit
+		//Timed out with victims still registered. While they are exiting
+		//or memory is being freed, keep waiting rather than kill more.
+		uint64_t usage = 0, limit;
+		cgc->backend->memory_usage(cgc, &usage, &limit);
+		if(cgc->victims < cgc->victims_armed || usage < cgc->usage_armed)
+		{
+			arm_victim_timer(cgc);
+			return;
+		}
+		slog(LOG_WARNING, "%s: %d victims made no progress in %d ms",
+			cgc->cgroup_name, cgc->victims, VICTIM_TIMEOUT_MS);
+	}
+	kill_or_recover(cgc, cgc->backend->is_oom(cgc));
+}
+
+//Waits VICTIM_TIMEOUT_MS for the victims, remembering how many there
+//are and the usage, so the timeout can tell whether they made progress
+static void arm_victim_timer(struct cgroup_context* cgc)
+{
+	uint64_t usage = 0, limit;
+	cgc->backend->memory_usage(cgc, &usage, &limit);
+	cgc->victims_armed = cgc->victims;
+	cgc->usage_armed = usage;
+	timer_source_arm(&cgc->victim_timer, VICTIM_TIMEOUT_MS, 0);
+}
+
+//oom is what is_oom() just returned: kill the next victim while it is 1,
+//otherwise stop handling
+static void kill_or_recover(struct cgroup_context* cgc, char oom)
+{
+	if(oom != 1 || find_victim(cgc) < 0)
+	{
+		//recovered, or the task list is empty (shouldn't happen)
+		if(oom == 0 && cgc->signalled) //not for events which needed no kill
+		{
+			latency_record(PHASE_RECOVER, cgc->signalled);
+			slog(LOG_INFO, "%s recovered %.3f ms after the event", cgc->cgroup_name,
+				latency_record(PHASE_TOTAL, cgc->oom_start) / 1e6);
+		}
+		cgc->signalled = 0;
+		cgc->handling = 0;
+		cgc->partial_kill = 0;
+		timer_source_arm(&cgc->victim_timer, 0, 0);
+		return;
+	}
+	//without pidfds there is nothing to wait on; poll as before
+	if(cgc->victims > 0)
+		arm_victim_timer(cgc);
+	else
+		timer_source_arm(&cgc->victim_timer, 1, 0);
+}
+
+static void oom_event(struct event_source* src, uint32_t events)
+{
+	struct cgroup_context* cgc = src->data;
+	char buf[4096]; //an eventfd counter, or queued inotify events
+	read(src->fd, buf, sizeof(buf));
+	if(cgc->handling)
+	{
+		oom_check(cgc, 0);
+		return;
+	}
+	//v2 memory.events also changes when the high and max counters move;
+	//only a new OOM starts handling
+	char oom = cgc->backend->is_oom(cgc);
+	if(oom != 1) return;
+	cgc->oom_start = event_loop_woke();
+	latency_record(PHASE_WAKE, cgc->oom_start);
+	latency_count(COUNT_EVENTS, 1);
+	cgc->handling = 1;
+	kill_or_recover(cgc, oom);
+}
+
+//Sustained memory pressure: kill before the cgroup reaches OOM, while
+//its tasks are still making progress. The trigger fires at most once
+//per window, so pressure that persists after a kill brings another.
+static void psi_event(struct event_source* src, uint32_t events)
+{
+	struct cgroup_context* cgc = src->data;
+	if(events & EPOLLERR) //the monitored cgroup went away
+	{
+		slog(LOG_ERR, "PSI trigger removed, no longer watching pressure");
+		event_loop_del(src);
+		close(src->fd);
+		src->fd = -1;
+		return;
+	}
+	if(cgc->handling || cgc->victims > 0) return; //already acting
+	slog(LOG_WARNING, "Memory pressure over threshold, intervening before OOM");
+	intervene(cgc);
+}
+
+//System-wide pressure, for the contexts without a trigger of their own:
+//intervene once, in the one whose usage is closest to its limit
+static void system_psi_event(struct event_source* src, uint32_t events)
+{
+	struct cgroup_context* contexts = src->data;
+	struct cgroup_context* victim = NULL;
+	double fullest = -1;
+	int i;
+	if(events & EPOLLERR)
+	{
+		slog(LOG_ERR, "PSI trigger removed, no longer watching pressure");
+		event_loop_del(src);
+		close(src->fd);
+		src->fd = -1;
+		return;
+	}
+	for(i = 0; i < system_psi_contexts; i++)
+	{
+		struct cgroup_context* cgc = &contexts[i];
+		uint64_t usage, limit;
+		double full = 0;
+		if(cgc->psi_source.fd >= 0) continue; //watched on its own
+		if(cgc->handling || cgc->victims > 0) return; //already acting
+		if(cgc->backend->memory_usage &&
+			cgc->backend->memory_usage(cgc, &usage, &limit) == 0 &&
+			limit > 0 && limit < (1ULL << 62))
+			full = (double)usage / limit;
+		if(full > fullest)
+		{
+			fullest = full;
+			victim = cgc;
+		}
+	}
+	if(!victim) return;
+	slog(LOG_WARNING, "System memory pressure over threshold, intervening in %s (%.0f%% of its limit)",
+		victim->cgroup_name, fullest * 100);
+	intervene(victim);
+}
+
+//Kills a victim without waiting for an OOM: on memory pressure, or when
+//asked to over the control socket. Returns -1 if an OOM is already being
+//handled or there was nothing to kill.
+int intervene(struct cgroup_context* cgc)
 {
-	char* command;
-	int len;
-	len = asprintf(&command, "1\n");
-	write(cgc->oomfd, command, len);
-	free(command);
+	if(cgc->handling || cgc->victims > 0) return(-1);
+	cgc->oom_start = event_loop_woke();
+	latency_record(PHASE_WAKE, cgc->oom_start);
+	latency_count(COUNT_EVENTS, 1);
+	if(find_victim(cgc) < 0) return(-1);
+	//from here on it is handled like an OOM: once the victims are gone,
+	//oom_check() stops unless the cgroup is actually out of memory
+	cgc->handling = 1;
+	if(cgc->victims > 0)
+		arm_victim_timer(cgc);
+	else
+		timer_source_arm(&cgc->victim_timer, 1, 0);
+	return(0);
 }
-void start_oomkiller(struct cgroup_context* cgc)
+
+//Leaves the main loop and re-executes with the same arguments, which
+//re-reads the -c config and every other setting
+void request_reload()
 {
-	char* command;
-	int len;
-	len = asprintf(&command, "0\n");
-	write(cgc->oomfd, command, len);
-	free(command);
+	slog(LOG_WARNING, "Reload requested, restarting");
+	restart_flag = 1;
+	exit_flag = 1;
+}
+
+//Usage crossed one of the -t thresholds. While it stays above them, keep
+//a ledger sampling in the background so that when the OOM comes
+//find_victim() only has to confirm the ledger's pick.
+void usage_warning(struct cgroup_context* cgc, char above)
+{
+	if(above)
+	{
+		if(cgc->ledger)
+		{
+			ledger_kick(cgc);
+		}
+		else if(ledger_start(cgc, WARM_SAMPLE_MS) == 0)
+		{
+			slog(LOG_INFO, "%s usage over threshold, sampling", cgc->cgroup_name);
+			cgc->ledger_on_demand = 1;
+		}
+	}
+	else if(cgc->ledger_on_demand)
+	{
+		slog(LOG_INFO, "%s usage back under threshold", cgc->cgroup_name);
+		ledger_stop(cgc);
+		cgc->ledger_on_demand = 0;
+	}
+}
+
+static void victim_timeout(struct event_source* src, uint32_t events)
+{
+	uint64_t expirations;
+	read(src->fd, &expirations, sizeof(uint64_t));
+	oom_check(src->data, 1);
+}
+
+static void add_cgroup_name(char*** names, int* n, const char* name)
+{
+	*names = realloc(*names, (*n + 1) * sizeof(char*));
+	asprintf(&((*names)[*n]), "%s", name);
+	(*n)++;
+}
+
+//One cgroup per line, relative to the memory hierarchy root, the same as
+//the argument to -g. Blank lines and lines starting with '#' are skipped.
+static int read_config(const char* path, char*** names, int* n)
+{
+	FILE* f = fopen(path, "r");
+	char* line = NULL;
+	size_t len = 0;
+	if(!f) return(-1);
+	while(getline(&line, &len, f) != -1)
+	{
+		char* start = line;
+		char* end;
+		while(*start == ' ' || *start == '\t') start++;
+		end = start + strlen(start);
+		while(end > start && (end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t'))
+			*--end = '\0';
+		if(*start == '\0' || *start == '#') continue;
+		add_cgroup_name(names, n, start);
+	}
+	free(line);
+	fclose(f);
+	return(0);
 }
 
 void exit_handler(int signal)
@@ -273,7 +775,7 @@ void crash_handler(int singal) //this will leak file descriptors
 	void* frames[100];
 	size_t size;
 	char** strings;
-	int i;
+	size_t i;
 	size = backtrace(frames, 100);
 	strings = backtrace_symbols(frames, size);
 	for(i=0;i<size;i++)
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Listens on the kernel proc connector for fork, exec, uid-change and
+//exit events and applies them to the ledger as they happen, so pid
+//ownership never has to be re-derived at OOM time. If the connector is
+//unavailable (no CAP_NET_ADMIN, or CONFIG_PROC_EVENTS is off) the ledger
+//is maintained by its periodic scan alone.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include <cgroup_context.h>
+
+#include <log.h>
+
+#include <ledger.h>
+#include <proc_events.h>
+
+static int nl_fd = -1;
+static pthread_t listener;
+static volatile char listener_stop;
+//contexts keep registering after the listener has started, so it may
+//only walk the list under watchers_lock
+static std::vector<struct cgroup_context*> watchers;
+static pthread_mutex_t watchers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int proc_events_subscribe(int fd, enum proc_cn_mcast_op op)
+{
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]
+		__attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr* nlh = (struct nlmsghdr*)buf;
+	struct cn_msg* cn = (struct cn_msg*)NLMSG_DATA(nlh);
+
+	memset(buf, 0, sizeof(buf));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nlh->nlmsg_pid = getpid();
+	nlh->nlmsg_type = NLMSG_DONE;
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+	if(send(fd, buf, nlh->nlmsg_len, 0) != (ssize_t)nlh->nlmsg_len) return(-1);
+	return(0);
+}
+
+static void proc_events_dispatch(const struct proc_event* ev)
+{
+	std::vector<struct cgroup_context*>::iterator i;
+	switch(ev->what)
+	{
+		case proc_event::PROC_EVENT_FORK:
+			//threads share the process entry
+			if(ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+				break;
+			for(i = watchers.begin(); i != watchers.end(); i++)
+				ledger_track_fork(*i, ev->event_data.fork.parent_tgid,
+					ev->event_data.fork.child_tgid);
+			break;
+		case proc_event::PROC_EVENT_UID:
+			//also covers setuid execs; commit_creds() reports those here
+			if(ev->event_data.id.process_pid != ev->event_data.id.process_tgid)
+				break;
+			for(i = watchers.begin(); i != watchers.end(); i++)
+				ledger_track_uid(*i, ev->event_data.id.process_tgid,
+					ev->event_data.id.r.ruid);
+			break;
+		case proc_event::PROC_EVENT_EXIT:
+			if(ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+				break;
+			for(i = watchers.begin(); i != watchers.end(); i++)
+				ledger_track_exit(*i, ev->event_data.exit.process_tgid);
+			break;
+		case proc_event::PROC_EVENT_EXEC:
+		default:
+			break;
+	}
+}
+
+static void* proc_events_listen(void* arg)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct pollfd pfd;
+	pfd.fd = nl_fd;
+	pfd.events = POLLIN;
+	while(!listener_stop)
+	{
+		if(poll(&pfd, 1, 500) <= 0) continue;
+		ssize_t len = recv(nl_fd, buf, sizeof(buf), 0);
+		if(len < 0)
+		{
+			//ENOBUFS means we fell behind; the next scan resyncs us
+			if(errno != EINTR && errno != ENOBUFS)
+				slog(LOG_WARNING, "proc connector recv: %s\n", strerror(errno));
+			continue;
+		}
+		for(struct nlmsghdr* nlh = (struct nlmsghdr*)buf;
+			NLMSG_OK(nlh, (size_t)len);
+			nlh = NLMSG_NEXT(nlh, len))
+		{
+			if(nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR)
+				continue;
+			struct cn_msg* cn = (struct cn_msg*)NLMSG_DATA(nlh);
+			if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+				continue;
+			pthread_mutex_lock(&watchers_lock);
+			proc_events_dispatch((struct proc_event*)cn->data);
+			pthread_mutex_unlock(&watchers_lock);
+		}
+	}
+	return(NULL);
+}
+
+extern "C"
+{
+//Register cgc's ledger for connector updates. The socket and listener
+//thread are shared by every context. Returns -1 if the connector is
+//unavailable, in which case the caller keeps relying on scans.
+int proc_events_start(struct cgroup_context* cgc)
+{
+	if(nl_fd < 0)
+	{
+		struct sockaddr_nl addr;
+		nl_fd = socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, NETLINK_CONNECTOR);
+		if(nl_fd < 0)
+		{
+			slog(LOG_WARNING, "proc connector unavailable: %s\n", strerror(errno));
+			return(-1);
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		addr.nl_groups = CN_IDX_PROC;
+		addr.nl_pid = getpid();
+		if(bind(nl_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			proc_events_subscribe(nl_fd, PROC_CN_MCAST_LISTEN) < 0)
+		{
+			slog(LOG_WARNING, "proc connector subscribe failed: %s\n",
+				strerror(errno));
+			close(nl_fd);
+			nl_fd = -1;
+			return(-1);
+		}
+		listener_stop = 0;
+		if(pthread_create(&listener, NULL, proc_events_listen, NULL) != 0)
+		{
+			slog(LOG_WARNING, "Failed to start proc connector listener\n");
+			close(nl_fd);
+			nl_fd = -1;
+			return(-1);
+		}
+	}
+	pthread_mutex_lock(&watchers_lock);
+	watchers.push_back(cgc);
+	pthread_mutex_unlock(&watchers_lock);
+	return(0);
+}
+
+void proc_events_stop()
+{
+	if(nl_fd < 0) return;
+	listener_stop = 1;
+	pthread_join(listener, NULL);
+	proc_events_subscribe(nl_fd, PROC_CN_MCAST_IGNORE);
+	close(nl_fd);
+	nl_fd = -1;
+	watchers.clear();
+}
+}
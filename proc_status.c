@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include <proc_status.h>
+#include <log.h>
+
+static int proc_fd = -1;
+static char* proc_root = NULL;
+
+//Looks for procfs at path instead of /proc (a fixture tree, say)
+void set_proc_root(const char* path)
+{
+	free(proc_root);
+	proc_root = strdup(path);
+	if(proc_fd >= 0)
+		close(proc_fd);
+	proc_fd = -1;
+}
+
+const char* get_proc_root()
+{
+	return(proc_root ? proc_root : "/proc");
+}
+
+//cached directory fd for /proc, so each status read is a single openat()
+int proc_dirfd()
+{
+	if(proc_fd < 0)
+	{
+		proc_fd = open(get_proc_root(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if(proc_fd < 0)
+			slog(LOG_ALERT, "Error opening %s: %s\n", get_proc_root(), strerror(errno));
+	}
+	return(proc_fd);
+}
+
+//parse "<value> <unit>" and return kB
+static memory_t parse_kb(const char* p, pid_t pid)
+{
+	char* end;
+	memory_t v = strtoull(p, &end, 10);
+	while(*end == ' ' || *end == '\t') end++;
+	if(end[0] == 'k' && end[1] == 'B') return(v);
+	if((end[0] == 'm' || end[0] == 'M') && end[1] == 'B') return(v << 10);
+	if((end[0] == 'g' || end[0] == 'G') && end[1] == 'B') return(v << 20);
+	if(end[0] == 'B') return(v >> 10);
+	slog(LOG_WARNING, "Unexpected memory unit in status of PID %d\n", pid);
+	return(v);
+}
+
+//returns pointer past "key" if line starts with it
+static const char* field(const char* line, const char* key, size_t len)
+{
+	if(strncmp(line, key, len) == 0) return(line + len);
+	return(NULL);
+}
+
+//Parses the contents of /proc/<pid>/status (NUL terminated) into ts.
+//Returns 0 on success, -1 if the buffer has no Uid line.
+int parse_task_status(pid_t pid, const char* buf, struct task_status* ts)
+{
+	memset(ts, 0, sizeof(*ts));
+	ts->pid = pid;
+
+	const char* line = buf;
+	const char* v;
+	while(line && *line)
+	{
+		switch(line[0])
+		{
+			case 'T':
+				if((v = field(line, "Tgid:", 5)))
+				{
+					ts->tgid = strtol(v, NULL, 10);
+					ts->found |= TS_TGID;
+				}
+				break;
+			case 'U':
+				if((v = field(line, "Uid:", 4)))
+				{
+					ts->uid = strtoul(v, NULL, 10);
+					ts->found |= TS_UID;
+				}
+				break;
+			case 'V':
+				if((v = field(line, "VmRSS:", 6)))
+				{
+					ts->rss = parse_kb(v, pid);
+					ts->found |= TS_RSS;
+				}
+				else if((v = field(line, "VmSwap:", 7)))
+				{
+					ts->swap = parse_kb(v, pid);
+					ts->found |= TS_SWAP;
+				}
+				break;
+			case 'N':
+				if((v = field(line, "NSpgid:", 7)))
+				{
+					ts->pgid = strtol(v, NULL, 10);
+					ts->found |= TS_PGID;
+				}
+				else if((v = field(line, "NSsid:", 6)))
+				{
+					ts->sid = strtol(v, NULL, 10);
+					ts->found |= TS_SID;
+				}
+				break;
+			case 'R':
+				if((v = field(line, "RssAnon:", 8)))
+				{
+					ts->rss_anon = parse_kb(v, pid);
+					ts->found |= TS_RSS_ANON;
+				}
+				else if((v = field(line, "RssShmem:", 9)))
+				{
+					ts->rss_shmem = parse_kb(v, pid);
+					ts->found |= TS_RSS_SHMEM;
+				}
+				break;
+		}
+		//VmSwap is the last field we want
+		if(ts->found & TS_SWAP) break;
+		line = strchr(line, '\n');
+		if(line) line++;
+	}
+
+	if(!(ts->found & TS_UID))
+	{
+		slog(LOG_ERR,"Error mapping UID for PID %d\n", pid);
+		return(-1);
+	}
+	//kthreads have no VmRSS; leave rss at 0
+	return(0);
+}
+
+//Reads /proc/<pid>/<file> into buf (NUL terminated, truncated to fit).
+//Returns the length, or -1 if the task could not be read (usually
+//because it exited while we were looking at it).
+ssize_t read_proc_file(pid_t pid, const char* file, char* buf, size_t size)
+{
+	char name[64];
+	size_t len = 0;
+	ssize_t r;
+	int fd;
+
+	snprintf(name, sizeof(name), "%d/%s", pid, file);
+	fd = openat(proc_dirfd(), name, O_RDONLY|O_CLOEXEC);
+	if(fd < 0) return(-1);
+	while(len < size - 1)
+	{
+		r = read(fd, buf + len, size - 1 - len);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) break;
+		len += r;
+	}
+	close(fd);
+	if(len == 0) return(-1);
+	buf[len] = '\0';
+	return(len);
+}
+
+//Reads /proc/<pid>/status once into a stack buffer and fills in ts.
+//Returns 0 on success, -1 if the task could not be read.
+int read_task_status(pid_t pid, struct task_status* ts)
+{
+	char buf[STATUS_BUF_SIZE];
+
+	memset(ts, 0, sizeof(*ts));
+	ts->pid = pid;
+	if(read_proc_file(pid, "status", buf, sizeof(buf)) < 0) return(-1);
+	return(parse_task_status(pid, buf, ts));
+}
+
+//Fills in pgid and sid (setting TS_PGID and TS_SID) from /proc/<pid>/stat,
+//for kernels whose status has no NSpgid and NSsid lines (before 4.1).
+//Returns 0 on success, -1 if the task could not be read.
+int read_task_ids(pid_t pid, struct task_status* ts)
+{
+	char buf[1024];
+	char state;
+	int ppid, pgrp, session;
+	if(read_proc_file(pid, "stat", buf, sizeof(buf)) < 0) return(-1);
+	//comm may contain spaces and parentheses, so start after the last ')'
+	const char* p = strrchr(buf, ')');
+	if(!p || sscanf(p + 1, " %c %d %d %d", &state, &ppid, &pgrp, &session) != 4)
+		return(-1);
+	ts->pgid = pgrp;
+	ts->sid = session;
+	ts->found |= TS_PGID|TS_SID;
+	return(0);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROC_STATUS_H__
+#define __PROC_STATUS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t memory_t; //kB
+
+//large enough for every field we care about; the lines after VmSwap
+//(signal masks, cpu lists) may be truncated on big machines, which is fine
+#define STATUS_BUF_SIZE 8192
+
+//bits in task_status.found
+#define TS_TGID		0x01
+#define TS_UID		0x02
+#define TS_RSS		0x04
+#define TS_RSS_ANON	0x08
+#define TS_RSS_SHMEM	0x10
+#define TS_SWAP		0x20
+#define TS_PGID		0x40
+#define TS_SID		0x80
+#define TS_PSS		0x100
+
+//Everything we need to know about a task, pulled out of a single
+//read of /proc/<pid>/status. Memory values are in kB.
+struct task_status
+{
+	pid_t pid;
+	pid_t tgid;
+	uid_t uid;
+	pid_t pgid; //in our pid namespace (first NSpgid value)
+	pid_t sid;
+	memory_t rss;
+	memory_t rss_anon;
+	memory_t rss_shmem;
+	memory_t swap;
+	memory_t pss; //Pss + SwapPss from smaps_rollup, PSS accounting only
+	memory_t pss_anon;
+	unsigned int found;
+	uint64_t cgroup; //inode of the cgroup it was found in, set by the walker
+};
+
+void set_proc_root(const char* path);
+const char* get_proc_root();
+int proc_dirfd();
+ssize_t read_proc_file(pid_t pid, const char* file, char* buf, size_t size);
+int parse_task_status(pid_t pid, const char* buf, struct task_status* ts);
+int read_task_status(pid_t pid, struct task_status* ts);
+int read_task_ids(pid_t pid, struct task_status* ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Compact binary snapshot of the process table, replacing the old
+//syslog dump of every /proc/<pid>/stat. find_victim() calls
+//proc_table_snapshot() after every kill, once the victims have been
+//signalled: it walks /proc into a buffer allocated up front and copies
+//that into the next slot of a rotating mmap'd file, so nothing on the
+//kill path reads /proc, formats text or waits on syslog. oomdump
+//decodes the file offline.
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <syslog.h>
+
+#include <proc_status.h>
+#include <proc_table.h>
+#include <log.h>
+
+struct linux_dirent64
+{
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+//cgroup path -> inode, direct mapped by path hash; a node has far more
+//tasks than cgroups, so most lookups avoid the stat()
+#define CGROUP_CACHE_SIZE 256
+
+struct cgroup_cache_entry
+{
+	uint64_t hash;
+	uint64_t ino;
+};
+
+static int map_fd = -1;
+static char* map = NULL;
+static size_t map_size;
+static struct proc_table_header* header;
+static struct proc_record* records = NULL;
+static struct proc_table_slot pending;
+static uint64_t seq;
+static int proc_fd = -1; //our own, getdents moves its offset
+static unsigned int page_kb;
+static char* root = NULL;
+static struct cgroup_cache_entry cgroup_cache[CGROUP_CACHE_SIZE];
+
+static struct proc_table_slot* slot(uint32_t i)
+{
+	return((struct proc_table_slot*)(map + sizeof(struct proc_table_header) +
+		i * header->slot_size));
+}
+
+//Opens (creating or reformatting as needed) the snapshot file at path
+//and allocates the capture buffer. cgroup_root is where the memory
+//cgroup paths in /proc/<pid>/cgroup are mounted. Returns 0 on success.
+int proc_table_open(const char* path, unsigned int slots,
+	unsigned int max_records, const char* cgroup_root)
+{
+	uint64_t slot_size = sizeof(struct proc_table_slot) +
+		(uint64_t)max_records * sizeof(struct proc_record);
+	map_size = sizeof(struct proc_table_header) + slots * slot_size;
+	map_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if(map_fd < 0)
+	{
+		slog(LOG_ERR, "Error opening %s: %s", path, strerror(errno));
+		return(-1);
+	}
+	struct stat st;
+	char reuse = 0;
+	struct proc_table_header h;
+	if(fstat(map_fd, &st) == 0 && st.st_size == (off_t)map_size &&
+		pread(map_fd, &h, sizeof(h), 0) == sizeof(h) &&
+		memcmp(h.magic, PROC_TABLE_MAGIC, 8) == 0 && h.slots == slots &&
+		h.max_records == max_records && h.record_size == sizeof(struct proc_record))
+		reuse = 1;
+	//a fresh file is sparse; slots take space as they are written
+	if(!reuse && (ftruncate(map_fd, 0) != 0 || ftruncate(map_fd, map_size) != 0))
+	{
+		slog(LOG_ERR, "Error sizing %s: %s", path, strerror(errno));
+		proc_table_close();
+		return(-1);
+	}
+	map = mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, map_fd, 0);
+	if(map == MAP_FAILED)
+	{
+		map = NULL;
+		slog(LOG_ERR, "Error mapping %s: %s", path, strerror(errno));
+		proc_table_close();
+		return(-1);
+	}
+	header = (struct proc_table_header*)map;
+	seq = 0;
+	if(reuse)
+	{
+		uint32_t i;
+		for(i = 0; i < slots; i++)
+			if(slot(i)->seq > seq) seq = slot(i)->seq;
+	}
+	else
+	{
+		memcpy(header->magic, PROC_TABLE_MAGIC, 8);
+		header->slots = slots;
+		header->max_records = max_records;
+		header->next = 0;
+		header->record_size = sizeof(struct proc_record);
+		header->slot_size = slot_size;
+	}
+	records = malloc(max_records * sizeof(struct proc_record));
+	proc_fd = open(get_proc_root(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(!records || proc_fd < 0)
+	{
+		slog(LOG_ERR, "Error setting up process table snapshots");
+		proc_table_close();
+		return(-1);
+	}
+	//touch every page now so capturing never faults in fresh memory
+	memset(records, 0, max_records * sizeof(struct proc_record));
+	memset(cgroup_cache, 0, sizeof(cgroup_cache));
+	page_kb = sysconf(_SC_PAGESIZE) / 1024;
+	asprintf(&root, "%s", cgroup_root);
+	return(0);
+}
+
+static uint64_t hash_path(const char* p, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL; //FNV-1a
+	size_t i;
+	for(i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ULL;
+	}
+	return(h ? h : 1);
+}
+
+//Inode of the task's memory cgroup: the v1 memory controller's line if
+//there is one, the unified hierarchy's otherwise.
+static uint64_t task_cgroup(pid_t pid)
+{
+	char buf[4096];
+	if(read_proc_file(pid, "cgroup", buf, sizeof(buf)) < 0) return(0);
+	char* p = strstr(buf, ":memory:");
+	if(p)
+		p += 8;
+	else if(strncmp(buf, "0::", 3) == 0)
+		p = buf + 3;
+	else if((p = strstr(buf, "\n0::")))
+		p += 4;
+	else
+		return(0);
+	size_t len = strcspn(p, "\n");
+	uint64_t h = hash_path(p, len);
+	struct cgroup_cache_entry* e = &cgroup_cache[h % CGROUP_CACHE_SIZE];
+	if(e->hash == h) return(e->ino);
+	char path[PATH_MAX];
+	struct stat st;
+	int n = snprintf(path, sizeof(path), "%s%.*s", root, (int)len, p);
+	if(n < 0 || (size_t)n >= sizeof(path) || stat(path, &st) != 0)
+		return(0);
+	e->hash = h;
+	e->ino = st.st_ino;
+	return(st.st_ino);
+}
+
+//Fills r from /proc/<pid>/stat. Returns -1 if the task is gone.
+static int read_record(pid_t pid, const char* name, struct proc_record* r)
+{
+	char buf[1024];
+	struct stat st;
+	if(read_proc_file(pid, "stat", buf, sizeof(buf)) < 0 ||
+		fstatat(proc_fd, name, &st, 0) != 0)
+		return(-1);
+	//comm may contain spaces and parentheses; fields resume after the last ')'
+	char* p = strrchr(buf, ')');
+	if(!p || p[1] != ' ') return(-1);
+	p += 2;
+	memset(r, 0, sizeof(*r));
+	r->pid = pid;
+	r->uid = st.st_uid;
+	r->state = *p++;
+	r->ppid = strtol(p, &p, 10);
+	int field;
+	for(field = 5; field < 22 && p; field++) //skip pgrp .. itrealvalue
+		p = strchr(p + 1, ' ');
+	if(!p) return(0);
+	r->starttime = strtoull(p, &p, 10);
+	strtoull(p, &p, 10); //vsize
+	r->rss = strtoull(p, &p, 10) * page_kb;
+	r->cgroup = task_cgroup(pid);
+	return(0);
+}
+
+static int record_pid_cmp(const void* a, const void* b)
+{
+	pid_t x = ((const struct proc_record*)a)->pid;
+	pid_t y = ((const struct proc_record*)b)->pid;
+	return(x < y ? -1 : x > y);
+}
+
+//Records every task in /proc into the capture buffer. Tasks beyond the
+//buffer's size are counted but not kept.
+static void capture()
+{
+	char buf[8192];
+	long n;
+	lseek(proc_fd, 0, SEEK_SET);
+	while((n = syscall(SYS_getdents64, proc_fd, buf, sizeof(buf))) > 0)
+	{
+		long off;
+		for(off = 0; off < n;)
+		{
+			struct linux_dirent64* de = (struct linux_dirent64*)(buf + off);
+			off += de->d_reclen;
+			if(de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+			pid_t pid = strtol(de->d_name, NULL, 10);
+			if(pending.count < header->max_records)
+			{
+				if(read_record(pid, de->d_name, &records[pending.count]) != 0)
+					continue;
+				pending.count++;
+			}
+			pending.seen++;
+		}
+	}
+}
+
+//The victims' memory as the scan saw it before the kill; those already
+//reaped are added back with state 'X'
+static void add_victims(const struct task_status* victims, size_t n)
+{
+	size_t i;
+	uint32_t walked = pending.count;
+	qsort(records, walked, sizeof(struct proc_record), record_pid_cmp);
+	for(i = 0; i < n; i++)
+	{
+		struct proc_record key;
+		key.pid = victims[i].pid;
+		struct proc_record* r = bsearch(&key, records, walked,
+			sizeof(struct proc_record), record_pid_cmp);
+		if(!r)
+		{
+			pending.seen++;
+			if(pending.count >= header->max_records) continue;
+			r = &records[pending.count++];
+			memset(r, 0, sizeof(*r));
+			r->pid = victims[i].pid;
+			r->uid = victims[i].uid;
+			r->state = 'X';
+			r->cgroup = victims[i].cgroup;
+		}
+		r->rss = victims[i].rss;
+	}
+	qsort(records, pending.count, sizeof(struct proc_record), record_pid_cmp);
+}
+
+//Stores the capture in the next slot
+static void write_slot()
+{
+	struct proc_table_slot* s = slot(header->next);
+	//the sequence number goes in last, so a torn slot reads as empty
+	s->seq = 0;
+	memcpy(s + 1, records, pending.count * sizeof(struct proc_record));
+	memcpy(s, &pending, sizeof(pending));
+	s->seq = ++seq;
+	header->next = (header->next + 1) % header->slots;
+	msync(map, map_size, MS_ASYNC);
+	if(pending.seen > pending.count)
+		slog(LOG_ERR, "Process table snapshot truncated to %u of %u tasks",
+			pending.count, pending.seen);
+}
+
+char proc_table_enabled()
+{
+	return(records != NULL);
+}
+
+//Snapshots the whole process table once victims have been signalled, so
+//the walk is never on the kill path. victims (n of them, may be NULL)
+//are the killed tasks as scanned before the kill.
+void proc_table_snapshot(const char* cgroup_name,
+	const struct task_status* victims, size_t n)
+{
+	if(!records) return;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&pending, 0, sizeof(pending));
+	pending.time = now.tv_sec;
+	snprintf(pending.cgroup, sizeof(pending.cgroup), "%s", cgroup_name);
+	capture();
+	add_victims(victims, n);
+	write_slot();
+}
+
+void proc_table_close()
+{
+	if(map)
+		munmap(map, map_size);
+	if(map_fd >= 0)
+		close(map_fd);
+	if(proc_fd >= 0)
+		close(proc_fd);
+	free(records);
+	free(root);
+	map = NULL;
+	map_fd = -1;
+	proc_fd = -1;
+	records = NULL;
+	root = NULL;
+}
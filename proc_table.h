@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROC_TABLE_H__
+#define __PROC_TABLE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//On-disk layout of the process-table snapshot file, shared with the
+//oomdump decoder. The file is a header followed by 'slots' fixed-size
+//slots, each a slot header and up to 'max_records' records. Snapshots
+//are written round robin; 'next' is the slot the next one goes to.
+//Everything is in host byte order.
+#define PROC_TABLE_MAGIC "OOMSNAP1"
+
+struct proc_table_header
+{
+	char magic[8];
+	uint32_t slots;
+	uint32_t max_records;
+	uint32_t next;
+	uint32_t record_size;
+	uint64_t slot_size; //bytes, slot header included
+};
+
+struct proc_table_slot
+{
+	uint64_t seq; //0: never written
+	int64_t time; //CLOCK_REALTIME seconds at capture
+	uint32_t count; //records stored
+	uint32_t seen; //tasks found, more than count if the slot was full
+	char cgroup[64]; //the cgroup whose event triggered the capture
+};
+
+struct proc_record
+{
+	int32_t pid;
+	int32_t ppid;
+	uint32_t uid; //owner of /proc/<pid>, i.e. the effective uid
+	char state; //R, S, D, Z, ...; X for a victim already reaped
+	char pad[3];
+	uint64_t rss; //kB; the victims' as scanned before the kill
+	uint64_t cgroup; //inode of its memory cgroup, 0 if unknown
+	uint64_t starttime; //clock ticks after boot
+};
+
+int proc_table_open(const char* path, unsigned int slots,
+	unsigned int max_records, const char* cgroup_root);
+char proc_table_enabled();
+struct task_status;
+void proc_table_snapshot(const char* cgroup_name,
+	const struct task_status* victims, size_t n);
+void proc_table_close();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
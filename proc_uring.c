@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Batched /proc/<pid>/status reads through io_uring. Opens, reads and
+//closes for up to 'depth' tasks are kept in flight at once; each
+//completion immediately queues the next step for that task, so there is
+//one io_uring_enter() per batch of completions instead of three blocking
+//syscalls per task. liburing is not required. If the kernel lacks
+//io_uring or the openat/read/close opcodes (pre 5.6), every call falls
+//back to read_task_status().
+//
+//Off unless -u is given: procfs reads can't be done asynchronously, so
+//the kernel hands each one to an io-wq worker, and at 50k tasks a scan
+//took 520 ms this way against 430 ms with plain reads.
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include <proc_status.h>
+#include <proc_uring.h>
+#include <log.h>
+
+#define OP_OPEN		0ULL
+#define OP_READ		1ULL
+#define OP_CLOSE	2ULL
+
+struct proc_uring
+{
+	int fd;
+	unsigned int depth;
+	unsigned int queued;
+	//submission ring
+	unsigned int* sq_head;
+	unsigned int* sq_tail;
+	unsigned int* sq_mask;
+	unsigned int* sq_array;
+	struct io_uring_sqe* sqes;
+	//completion ring
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int* cq_mask;
+	struct io_uring_cqe* cqes;
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+	//per-slot state, preallocated
+	char* bufs;
+	char (*names)[32];
+	int* fds;
+	size_t* task;
+	unsigned int* free_slots;
+	unsigned int nfree;
+};
+
+static struct proc_uring* ring = NULL;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char uring_supported(int fd)
+{
+	size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = calloc(1, len);
+	char ok = 0;
+	if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+	{
+		ok = probe->last_op >= IORING_OP_CLOSE &&
+			(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+			(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+			(probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	return(ok);
+}
+
+static void uring_free(struct proc_uring* u)
+{
+	if(u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_len);
+	if(u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_len);
+	if(u->sq_ptr && u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_len);
+	if(u->fd >= 0) close(u->fd);
+	free(u->bufs);
+	free(u->names);
+	free(u->fds);
+	free(u->task);
+	free(u->free_slots);
+	free(u);
+}
+
+int proc_uring_init(unsigned int depth)
+{
+	struct io_uring_params p;
+	struct proc_uring* u = calloc(1, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if(u->fd < 0 || !uring_supported(u->fd))
+	{
+		slog(LOG_WARNING, "io_uring unavailable, using synchronous /proc reads\n");
+		uring_free(u);
+		return(-1);
+	}
+	u->depth = p.sq_entries < depth ? p.sq_entries : depth;
+
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+		u->cq_len = u->sq_len;
+	}
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ptr = u->sq_ptr;
+	else
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED || u->sqes == MAP_FAILED)
+	{
+		slog(LOG_WARNING, "io_uring mmap failed, using synchronous /proc reads\n");
+		uring_free(u);
+		return(-1);
+	}
+	u->sq_head = (unsigned int*)((char*)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned int*)((char*)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned int*)((char*)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int*)((char*)u->sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned int*)((char*)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned int*)((char*)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned int*)((char*)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*)((char*)u->cq_ptr + p.cq_off.cqes);
+
+	u->bufs = malloc((size_t)u->depth * STATUS_BUF_SIZE);
+	u->names = malloc((size_t)u->depth * sizeof(*u->names));
+	u->fds = malloc(u->depth * sizeof(int));
+	u->task = malloc(u->depth * sizeof(size_t));
+	u->free_slots = malloc(u->depth * sizeof(unsigned int));
+	ring = u;
+	return(0);
+}
+
+char proc_uring_enabled()
+{
+	return(ring != NULL);
+}
+
+void proc_uring_exit()
+{
+	if(!ring) return;
+	uring_free(ring);
+	ring = NULL;
+}
+
+static struct io_uring_sqe* uring_sqe(struct proc_uring* u, uint64_t op, unsigned int slot)
+{
+	unsigned int tail = *u->sq_tail;
+	unsigned int idx = tail & *u->sq_mask;
+	struct io_uring_sqe* sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (op << 32) | slot;
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->queued++;
+	return(sqe);
+}
+
+//Reads the status of n tasks. Entries which could not be read (usually
+//because the task exited) are left with found == 0. Returns the number
+//read successfully.
+size_t read_task_status_batch(const pid_t* pids, size_t n, struct task_status* out)
+{
+	size_t i, next = 0, done = 0, ok = 0;
+	struct proc_uring* u;
+	if(!ring)
+	{
+		for(i = 0; i < n; i++)
+		{
+			if(read_task_status(pids[i], &out[i]) == 0) ok++;
+			else out[i].found = 0;
+		}
+		return(ok);
+	}
+
+	pthread_mutex_lock(&ring_lock);
+	u = ring;
+	u->queued = 0;
+	u->nfree = u->depth;
+	for(i = 0; i < u->depth; i++) u->free_slots[i] = u->depth - 1 - i;
+	for(i = 0; i < n; i++)
+	{
+		memset(&out[i], 0, sizeof(out[i]));
+		out[i].pid = pids[i];
+	}
+
+	while(done < n)
+	{
+		//every slot has at most one op in flight, so the SQ never overflows
+		while(next < n && u->nfree > 0)
+		{
+			unsigned int s = u->free_slots[--(u->nfree)];
+			struct io_uring_sqe* sqe = uring_sqe(u, OP_OPEN, s);
+			u->task[s] = next;
+			snprintf(u->names[s], sizeof(u->names[s]), "%d/status", pids[next]);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = proc_dirfd();
+			sqe->addr = (uint64_t)(uintptr_t)u->names[s];
+			sqe->open_flags = O_RDONLY|O_CLOEXEC;
+			next++;
+		}
+		int r = syscall(__NR_io_uring_enter, u->fd, u->queued, 1,
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if(r < 0 && errno != EINTR)
+		{
+			slog(LOG_ALERT, "io_uring_enter: %s, disabling io_uring\n", strerror(errno));
+			//ops already in flight still complete into our buffers
+			break;
+		}
+		if(r > 0) u->queued -= r;
+
+		unsigned int head = *u->cq_head;
+		while(head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+			unsigned int s = cqe->user_data & 0xffffffff;
+			uint64_t op = cqe->user_data >> 32;
+			int res = cqe->res;
+			head++;
+			if(op == OP_OPEN)
+			{
+				if(res < 0) //task exited
+				{
+					u->free_slots[(u->nfree)++] = s;
+					done++;
+					continue;
+				}
+				u->fds[s] = res;
+				struct io_uring_sqe* sqe = uring_sqe(u, OP_READ, s);
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = res;
+				sqe->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)s * STATUS_BUF_SIZE);
+				sqe->len = STATUS_BUF_SIZE - 1;
+				sqe->off = 0;
+			}
+			else if(op == OP_READ)
+			{
+				char* buf = u->bufs + (size_t)s * STATUS_BUF_SIZE;
+				size_t t = u->task[s];
+				if(res > 0)
+				{
+					buf[res] = '\0';
+					if(parse_task_status(pids[t], buf, &out[t]) == 0) ok++;
+					else out[t].found = 0;
+				}
+				struct io_uring_sqe* sqe = uring_sqe(u, OP_CLOSE, s);
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = u->fds[s];
+			}
+			else
+			{
+				u->free_slots[(u->nfree)++] = s;
+				done++;
+			}
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+	if(done < n)
+	{
+		//the ring broke mid-batch; leave it to drain and go synchronous
+		ring = NULL;
+		pthread_mutex_unlock(&ring_lock);
+		for(i = 0; i < n; i++)
+		{
+			if(out[i].found) continue;
+			if(read_task_status(pids[i], &out[i]) == 0) ok++;
+		}
+		return(ok);
+	}
+	pthread_mutex_unlock(&ring_lock);
+	return(ok);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include <cgroup_context.h>
+#include <psi.h>
+#include <proc_status.h>
+
+#include <log.h>
+
+int psi_trigger_open(struct cgroup_context* cgc, const char* trigger)
+{
+	char* path;
+	if(cgc)
+		asprintf(&path, "%s/%s/memory.pressure", cgc->cgroup_path, cgc->cgroup_name);
+	else
+		asprintf(&path, "%s/pressure/memory", get_proc_root());
+	int fd = open(path, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+	if(fd < 0)
+	{
+		int err = errno;
+		if(!cgc || err != ENOENT) //v1 has no per-cgroup pressure
+			slog(LOG_ALERT, "Failed to open memory pressure (PSI): %s", strerror(err));
+		free(path);
+		errno = err;
+		return(-1);
+	}
+	//the trigger lives as long as the fd; the kernel wants the NUL too
+	if(write(fd, trigger, strlen(trigger) + 1) < 0)
+	{
+		slog(LOG_ALERT, "Failed to set PSI trigger \"%s\" on %s: %s",
+			trigger, path, strerror(errno));
+		close(fd);
+		free(path);
+		errno = EINVAL;
+		return(-1);
+	}
+	slog(LOG_INFO, "PSI trigger \"%s\" set on %s", trigger, path);
+	free(path);
+	return(fd);
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <proc_status.h>
+#include <pss_cache.h>
+
+//entries not used for this long are dropped
+#define PSS_CACHE_EXPIRE_S 60
+
+//A pid reused since the entry was made is caught by its owner, session
+//or process group differing, all read by the status pass anyway, or
+//else by its RSS
+struct pss_entry
+{
+	uid_t uid;
+	pid_t pgid;
+	pid_t sid;
+	memory_t rss; //VmRSS when pss was read
+	memory_t pss;
+	memory_t pss_anon;
+	time_t used;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<pid_t, pss_entry> cache;
+static time_t pruned;
+
+static time_t now_s()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec);
+}
+
+static memory_t rollup_value(const char* buf, const char* key)
+{
+	const char* p = strstr(buf, key);
+	if(!p) return(0);
+	return(strtoull(p + strlen(key), NULL, 10));
+}
+
+static int read_rollup(pid_t pid, pss_entry& e)
+{
+	char buf[4096];
+	if(read_proc_file(pid, "smaps_rollup", buf, sizeof(buf)) < 0) return(-1);
+	e.pss = rollup_value(buf, "\nPss:") + rollup_value(buf, "\nSwapPss:");
+	e.pss_anon = rollup_value(buf, "\nPss_Anon:");
+	return(0);
+}
+
+static void prune(time_t now)
+{
+	for(std::map<pid_t, pss_entry>::iterator i = cache.begin(); i != cache.end();)
+	{
+		std::map<pid_t, pss_entry>::iterator next = i;
+		next++;
+		if(now - i->second.used > PSS_CACHE_EXPIRE_S)
+			cache.erase(i);
+		i = next;
+	}
+	pruned = now;
+}
+
+extern "C"
+{
+void task_pss(struct task_status* ts)
+{
+	time_t now = now_s();
+	if(ts->rss == 0) return; //kthread, or nothing resident
+
+	pthread_mutex_lock(&cache_lock);
+	std::map<pid_t, pss_entry>::iterator i = cache.find(ts->pid);
+	if(i != cache.end() && i->second.uid == ts->uid &&
+		i->second.pgid == ts->pgid && i->second.sid == ts->sid)
+	{
+		memory_t old = i->second.rss;
+		memory_t delta = ts->rss > old ? ts->rss - old : old - ts->rss;
+		if(delta <= old / 8)
+		{
+			i->second.used = now;
+			ts->pss = i->second.pss;
+			ts->pss_anon = i->second.pss_anon;
+			ts->found |= TS_PSS;
+			pthread_mutex_unlock(&cache_lock);
+			return;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	//read outside the lock; it is the slow part
+	pss_entry e;
+	if(read_rollup(ts->pid, e) != 0) return;
+	e.uid = ts->uid;
+	e.pgid = ts->pgid;
+	e.sid = ts->sid;
+	e.rss = ts->rss;
+	e.used = now;
+	ts->pss = e.pss;
+	ts->pss_anon = e.pss_anon;
+	ts->found |= TS_PSS;
+
+	pthread_mutex_lock(&cache_lock);
+	cache[ts->pid] = e;
+	if(now - pruned > PSS_CACHE_EXPIRE_S)
+		prune(now);
+	pthread_mutex_unlock(&cache_lock);
+}
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//A small pool of pre-spawned threads which walk a cgroup hierarchy in
+//parallel. Each worker owns a deque of cgroups still to be scanned, by
+//path: it pushes each child onto the back as soon as it is listed and
+//pops from the back, and when it runs dry it steals from the front of
+//another worker's deque. A cgroup is only opened when it is scanned.
+//A worker which finds every deque empty sleeps until more cgroups are
+//queued or the walk is over. Each worker accumulates its own partial snapshot, and the partials are
+//merged once the walk is complete.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include <log.h>
+
+#include <snapshot.h>
+#include <scan_pool.h>
+
+struct scan_worker
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	std::deque<std::string> queue; //cgroup paths relative to walk_root
+	struct snapshot partial;
+	unsigned int index;
+};
+
+static std::vector<scan_worker*> workers;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER; //one walk at a time
+static unsigned int generation;
+static unsigned int active;
+static char pool_stop;
+static volatile long pending; //cgroups queued or being scanned
+static volatile long queued; //cgroups in the deques
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_wake = PTHREAD_COND_INITIALIZER;
+static volatile long idle; //workers waiting on idle_wake
+static int walk_root; //directory fd of the hierarchy being walked
+
+static bool take_own(scan_worker* w, std::string& item)
+{
+	bool got = false;
+	pthread_mutex_lock(&w->lock);
+	if(!w->queue.empty())
+	{
+		item.swap(w->queue.back());
+		w->queue.pop_back();
+		__sync_fetch_and_sub(&queued, 1);
+		got = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return(got);
+}
+
+static bool steal(scan_worker* w, std::string& item)
+{
+	size_t n = workers.size();
+	for(size_t k = 1; k < n; k++)
+	{
+		scan_worker* victim = workers[(w->index + k) % n];
+		pthread_mutex_lock(&victim->lock);
+		if(!victim->queue.empty())
+		{
+			item.swap(victim->queue.front());
+			victim->queue.pop_front();
+			__sync_fetch_and_sub(&queued, 1);
+			pthread_mutex_unlock(&victim->lock);
+			return(true);
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return(false);
+}
+
+//Wakes an idle worker to take a new cgroup, or all of them once the walk
+//is over. The
+//counters are updated before idle is read here and idle before they are
+//read in wait_for_work(), both with full barriers, so either the waiter
+//sees the work or we see the waiter; it holds idle_lock from its check
+//until it sleeps, so the broadcast can't fall in between.
+static void wake_idle(bool all)
+{
+	if(__sync_fetch_and_add(&idle, 0) == 0) return;
+	pthread_mutex_lock(&idle_lock);
+	if(all)
+		pthread_cond_broadcast(&idle_wake);
+	else
+		pthread_cond_signal(&idle_wake);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+//Sleeps while every deque is empty but other workers are still scanning
+static void wait_for_work()
+{
+	pthread_mutex_lock(&idle_lock);
+	__sync_fetch_and_add(&idle, 1);
+	while(__sync_fetch_and_add(&queued, 0) == 0 &&
+		__sync_fetch_and_add(&pending, 0) > 0)
+		pthread_cond_wait(&idle_wake, &idle_lock);
+	__sync_fetch_and_sub(&idle, 1);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+//scan_cgroup() callback: makes a child available to every worker at once
+static void publish(void* arg, const std::string& path)
+{
+	scan_worker* w = (scan_worker*)arg;
+	__sync_fetch_and_add(&pending, 1);
+	pthread_mutex_lock(&w->lock);
+	w->queue.push_back(path);
+	__sync_fetch_and_add(&queued, 1);
+	pthread_mutex_unlock(&w->lock);
+	wake_idle(false);
+}
+
+static void worker_walk(scan_worker* w)
+{
+	std::string item;
+	while(__sync_fetch_and_add(&pending, 0) > 0)
+	{
+		if(!take_own(w, item) && !steal(w, item))
+		{
+			wait_for_work();
+			continue;
+		}
+		scan_cgroup(walk_root, item, w->partial, publish, w);
+		if(__sync_sub_and_fetch(&pending, 1) == 0)
+			wake_idle(true);
+	}
+}
+
+static void* worker_main(void* arg)
+{
+	scan_worker* w = (scan_worker*)arg;
+	unsigned int seen = 0;
+	pthread_mutex_lock(&pool_lock);
+	while(1)
+	{
+		while(!pool_stop && seen == generation)
+			pthread_cond_wait(&pool_start, &pool_lock);
+		if(pool_stop) break;
+		seen = generation;
+		pthread_mutex_unlock(&pool_lock);
+
+		worker_walk(w);
+
+		pthread_mutex_lock(&pool_lock);
+		if(--active == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return(NULL);
+}
+
+//fold the workers' partial snapshots into snap. A process whose threads
+//sit in several cgroups can be seen by more than one worker; the
+//duplicates are taken back out of the per-uid totals.
+static void merge_partials(struct snapshot& snap)
+{
+	for(std::vector<scan_worker*>::iterator w = workers.begin();
+		w != workers.end();
+		w++)
+	{
+		struct snapshot& p = (*w)->partial;
+		for(std::map<uid_t, user_usage>::iterator u = p.users.begin();
+			u != p.users.end();
+			u++)
+		{
+			user_usage& t = snap.users[u->first];
+			t.rss += u->second.rss;
+			t.pids.insert(t.pids.end(), u->second.pids.begin(), u->second.pids.end());
+		}
+		for(std::vector<struct task_status>::iterator t = p.tasks.begin();
+			t != p.tasks.end();
+			t++)
+		{
+			if(snap.seen.insert(t->pid).second)
+			{
+				snap.tasks.push_back(*t);
+				continue;
+			}
+			user_usage& u = snap.users[t->uid];
+			u.rss -= t->rss;
+			for(std::vector<pid_t>::iterator i = u.pids.begin(); i != u.pids.end(); i++)
+			{
+				if(*i == t->pid)
+				{
+					u.pids.erase(i);
+					break;
+				}
+			}
+		}
+		for(size_t i = 0; i < p.pending.size(); i++)
+		{
+			if(snap.seen.insert(p.pending[i]).second)
+			{
+				snap.pending.push_back(p.pending[i]);
+				snap.pending_cgroups.push_back(p.pending_cgroups[i]);
+			}
+		}
+		//overwrite: an earlier scan may have recorded one of these as a
+		//root, without its parent
+		for(std::map<uint64_t, cgroup_node>::iterator c = p.cgroups.begin();
+			c != p.cgroups.end();
+			c++)
+			snap.cgroups[c->first] = c->second;
+		snap.charges.insert(p.charges.begin(), p.charges.end());
+		p.tasks.clear();
+		p.users.clear();
+		p.cgroups.clear();
+		p.charges.clear();
+		p.seen.clear();
+		p.pending.clear();
+		p.pending_cgroups.clear();
+	}
+}
+
+extern "C"
+{
+int scan_pool_start(unsigned int nthreads)
+{
+	for(unsigned int i = 0; i < nthreads; i++)
+	{
+		scan_worker* w = new scan_worker;
+		w->index = i;
+		pthread_mutex_init(&w->lock, NULL);
+		if(pthread_create(&w->thread, NULL, worker_main, w) != 0)
+		{
+			slog(LOG_WARNING, "Started only %u of %u scan threads\n", i, nthreads);
+			pthread_mutex_destroy(&w->lock);
+			delete w;
+			break;
+		}
+		workers.push_back(w);
+	}
+	return(workers.empty() ? -1 : 0);
+}
+
+void scan_pool_stop()
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_stop = 1;
+	pthread_cond_broadcast(&pool_start);
+	pthread_mutex_unlock(&pool_lock);
+	for(std::vector<scan_worker*>::iterator w = workers.begin();
+		w != workers.end();
+		w++)
+	{
+		pthread_join((*w)->thread, NULL);
+		pthread_mutex_destroy(&(*w)->lock);
+		delete *w;
+	}
+	workers.clear();
+	pool_stop = 0;
+}
+
+unsigned int scan_pool_threads()
+{
+	return(workers.empty() ? 1 : workers.size());
+}
+}
+
+//Walk the hierarchy under dirfd with the pool; the fd is consumed.
+//Returns false if no pool is running, in which case the caller walks
+//serially.
+bool scan_pool_enumerate(int dirfd, struct snapshot& snap)
+{
+	if(workers.empty()) return(false);
+	pthread_mutex_lock(&scan_lock);
+	walk_root = dirfd;
+	workers[0]->queue.push_back(".");
+	pending = 1;
+	queued = 1;
+	pthread_mutex_lock(&pool_lock);
+	active = workers.size();
+	generation++;
+	pthread_cond_broadcast(&pool_start);
+	while(active > 0)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+	close(dirfd);
+	merge_partials(snap);
+	pthread_mutex_unlock(&scan_lock);
+	return(true);
+}
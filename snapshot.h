@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <proc_status.h>
+
+//Memory use and process list for one uid (or one unit of another
+//aggregation key), built in a single walk so the kill phase sees exactly
+//the tasks that selection counted
+struct user_usage
+{
+	memory_t rss;
+	memory_t swap; //VmSwap
+	std::vector<pid_t> pids;
+	uid_t uid; //owner: uid of the unit's first process
+	user_usage() : rss(0), swap(0), uid(0) {}
+};
+
+//A directory in the scanned hierarchy, keyed in the snapshot by inode
+//(which is the cgroup id on cgroup v2)
+struct cgroup_node
+{
+	uint64_t parent; //0 for the root of the walk
+	std::string name;
+	cgroup_node() : parent(0) {}
+};
+
+//What the kernel charges a cgroup, from its memory.stat (cgroup
+//accounting mode). total is hierarchical on v2, local on v1.
+struct cgroup_charge
+{
+	memory_t total; //kB
+	char hierarchical;
+	char owned; //has processes; owner is the uid of the first one
+	uid_t owner;
+	cgroup_charge() : total(0), hierarchical(0), owned(0), owner(0) {}
+};
+
+struct snapshot
+{
+	std::vector<struct task_status> tasks;
+	std::map<uid_t, user_usage> users;
+	std::map<uint64_t, cgroup_node> cgroups;
+	std::map<uint64_t, cgroup_charge> charges; //cgroup accounting only
+	std::set<pid_t> seen; //threads split across cgroups
+	std::vector<pid_t> pending; //found but not yet read (io_uring batches)
+	std::vector<uint64_t> pending_cgroups;
+};
+
+std::string cgroup_relpath(const struct snapshot& snap, uint64_t cgroup);
+
+//Called with each child cgroup scan_cgroup() finds, as it finds it
+typedef void (*cgroup_found)(void* arg, const std::string& path);
+
+void scan_cgroup(int rootfd, const std::string& path, struct snapshot& snap,
+	cgroup_found found, void* arg);
+void enumerate_users(char* cgpath, struct snapshot& snap);
+
+struct cgroup_context;
+bool scan_units(struct cgroup_context* cgc, struct snapshot& snap,
+	std::map<uint64_t, user_usage>& units, bool verbose);
+void set_victim_tracking(bool on);
+bool sample_units(char* cgpath, std::map<uint64_t, user_usage>& units);
+double unit_score(struct cgroup_context* cgc, uint64_t key, const user_usage& usage,
+	double& rate);
+
+#endif
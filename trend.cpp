@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015, University Corporation for Atmospheric Research
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//Recent memory use of each unit (uid, job, ...) of one cgroup, kept as a
+//short fixed-size ring of samples per unit. A sampler thread scans the
+//cgroup and hands each result to the event loop, which folds it into the
+//rings; units that disappear drop their history.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+
+#include <cgroup_context.h>
+#include <event_loop.h>
+
+#include <log.h>
+
+#include <snapshot.h>
+#include <trend.h>
+
+//samples kept per unit; the rate is measured across all of them
+#define TREND_SAMPLES 8
+
+struct trend_series
+{
+	uint64_t when[TREND_SAMPLES]; //ms, CLOCK_MONOTONIC
+	memory_t rss[TREND_SAMPLES];
+	unsigned int head; //next slot to write
+	unsigned int count;
+	unsigned int generation;
+	trend_series() : head(0), count(0), generation(0) {}
+};
+
+struct trend
+{
+	struct event_source ready; //eventfd, written when 'sampled' is filled
+	struct cgroup_context* cgc;
+	unsigned int generation;
+	std::map<uint64_t, trend_series> series; //event loop only
+
+	//shared with the sampler thread, under lock
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	char stop;
+	char* cgpath;
+	unsigned int interval_ms;
+	bool fresh;
+	std::map<uint64_t, user_usage> sampled;
+};
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+void trend_record(struct trend* t, const std::map<uint64_t, user_usage>& units)
+{
+	uint64_t now = now_ms();
+	unsigned int gen = ++(t->generation);
+	for(std::map<uint64_t, user_usage>::const_iterator u = units.begin();
+		u != units.end();
+		u++)
+	{
+		trend_series& s = t->series[u->first];
+		s.when[s.head] = now;
+		s.rss[s.head] = u->second.rss;
+		s.head = (s.head + 1) % TREND_SAMPLES;
+		if(s.count < TREND_SAMPLES) s.count++;
+		s.generation = gen;
+	}
+	for(std::map<uint64_t, trend_series>::iterator s = t->series.begin();
+		s != t->series.end();)
+	{
+		std::map<uint64_t, trend_series>::iterator next = s;
+		next++;
+		if(s->second.generation != gen)
+			t->series.erase(s);
+		s = next;
+	}
+}
+
+//Growth in kB/s from the oldest sample held to current, 0 if the unit
+//is shrinking or has no history yet
+double trend_rate(const struct trend* t, uint64_t key, memory_t current)
+{
+	if(!t) return(0);
+	std::map<uint64_t, trend_series>::const_iterator s = t->series.find(key);
+	if(s == t->series.end() || s->second.count == 0) return(0);
+	unsigned int oldest = (s->second.head + TREND_SAMPLES - s->second.count) %
+		TREND_SAMPLES;
+	uint64_t dt = now_ms() - s->second.when[oldest];
+	if(dt < 100 || current <= s->second.rss[oldest]) return(0);
+	return((current - s->second.rss[oldest]) * 1000.0 / dt);
+}
+
+//Runs on the event loop when the sampler has a result
+static void trend_fold(struct event_source* src, uint32_t events)
+{
+	struct trend* t = (struct trend*)src->data;
+	uint64_t count;
+	std::map<uint64_t, user_usage> units;
+	read(src->fd, &count, sizeof(uint64_t));
+	pthread_mutex_lock(&t->lock);
+	bool fresh = t->fresh;
+	t->fresh = false;
+	units.swap(t->sampled);
+	pthread_mutex_unlock(&t->lock);
+	if(fresh)
+		trend_record(t, units);
+}
+
+static void* trend_sampler(void* arg)
+{
+	struct trend* t = (struct trend*)arg;
+	uint64_t one = 1;
+	pthread_mutex_lock(&t->lock);
+	while(!t->stop)
+	{
+		pthread_mutex_unlock(&t->lock);
+		std::map<uint64_t, user_usage> units;
+		bool ok = sample_units(t->cgpath, units);
+		pthread_mutex_lock(&t->lock);
+		if(ok)
+		{
+			t->sampled.swap(units);
+			t->fresh = true;
+			write(t->ready.fd, &one, sizeof(uint64_t));
+		}
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += t->interval_ms / 1000;
+		deadline.tv_nsec += (t->interval_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while(!t->stop &&
+			pthread_cond_timedwait(&t->wake, &t->lock, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&t->lock);
+	return(NULL);
+}
+
+extern "C"
+{
+int trend_start(struct cgroup_context* cgc, unsigned int interval_ms)
+{
+	struct trend* t = new trend;
+	pthread_condattr_t attr;
+	t->cgc = cgc;
+	t->generation = 0;
+	t->stop = 0;
+	t->interval_ms = interval_ms;
+	t->fresh = false;
+	t->ready.fd = eventfd(0, EFD_CLOEXEC);
+	t->ready.handler = trend_fold;
+	t->ready.data = t;
+	if(t->ready.fd < 0 || event_loop_add(&t->ready, EPOLLIN) != 0)
+	{
+		slog(LOG_ALERT, "Failed to start growth sampling\n");
+		if(t->ready.fd >= 0) close(t->ready.fd);
+		delete t;
+		return(-1);
+	}
+	asprintf(&t->cgpath, "/%s/%s/", cgc->cgroup_path, cgc->cgroup_name);
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	if(pthread_create(&t->thread, NULL, trend_sampler, t) != 0)
+	{
+		slog(LOG_ALERT, "Failed to start growth sampling\n");
+		event_loop_del(&t->ready);
+		close(t->ready.fd);
+		pthread_cond_destroy(&t->wake);
+		pthread_mutex_destroy(&t->lock);
+		free(t->cgpath);
+		delete t;
+		return(-1);
+	}
+	cgc->trend = t;
+	return(0);
+}
+
+void trend_stop(struct cgroup_context* cgc)
+{
+	struct trend* t = cgc->trend;
+	if(!t) return;
+	pthread_mutex_lock(&t->lock);
+	t->stop = 1;
+	pthread_cond_signal(&t->wake);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->thread, NULL);
+	event_loop_del(&t->ready);
+	close(t->ready.fd);
+	pthread_cond_destroy(&t->wake);
+	pthread_mutex_destroy(&t->lock);
+	free(t->cgpath);
+	delete t;
+	cgc->trend = NULL;
+}
+}